@@ -2,17 +2,52 @@
  *
  * Extended Binary Search Tree program with many utilities:
  * - insert (recursive), insert_iterative
- * - delete, search
+ * - delete, search, bulk delete_range (split and splice) / delete_if (subtree rebuild)
  * - traversals: inorder, preorder, postorder, level-order
+ * - predecessor/successor, or both at once (plus floor/ceiling) via neighbors
  * - height, node count, leaf count
- * - save/load to file, print stats
+ * - save/load to file (text preorder, or succinct binary snapshots), print stats
+ * - persistent (copy-on-write) versions with lock-free snapshot reads
+ * - finger (last-access) search/insert for nearly-sorted key streams
+ * - shape report and optional access counters (build with -DBST_STATS)
+ * - optional Robin Hood hash index for O(1) exact-key lookups
+ * - optional blocked Bloom filter answering definite misses without a descent
+ * - sharded ordered set: range-partitioned trees, one worker thread each
+ * - hardware counters in benchmarks (run with PERF_COUNTERS=1, see perf_counters.h)
+ * - server mode on a Unix-domain socket (epoll, pipelined binary protocol):
+ *     bst_ext --serve <socket> [tree-file]
+ *     bst_ext --client <socket> <ops> <pipeline-depth>   (load generator)
+ * - epoch-based reclamation for deletes running alongside lock-free readers:
+ *     bst_ext --ebr-stress <readers> <writers> <seconds>
+ *   (build with -fsanitize=thread to check it under ThreadSanitizer)
+ * - randomized differential tester for all tree variants:
+ *     bst_ext --fuzz <ops> [seed]
  *
- * Compile: gcc -std=c11 -O2 -o bst_ext bst_ext.c
+ * Compile: gcc -std=c11 -O2 -pthread -o bst_ext bst_ext.c
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "perf_counters.h"
 
 struct Node {
     int key;
@@ -20,45 +55,175 @@ struct Node {
     struct Node *right;
 };
 
+/* Access counters, compiled in only with -DBST_STATS so the default build
+   pays nothing. Comparisons are three-way key comparisons (one per node
+   visited); the depth histogram records the path length of every op. */
+#ifdef BST_STATS
+#define DEPTH_BUCKETS 64
+struct BstStats {
+    unsigned long long searches, inserts, deletes;
+    unsigned long long cmp_search, cmp_insert, cmp_delete;
+    unsigned long long depth_hist[DEPTH_BUCKETS]; /* last bucket: deeper */
+    unsigned long long allocs, frees;
+    unsigned long long rebuilds; /* subtrees rebuilt by bulk deletes */
+};
+static struct BstStats bst_stats;
+#define STAT_INC(field) (bst_stats.field++)
+#define STAT_DEPTH(d) (bst_stats.depth_hist[(d) < DEPTH_BUCKETS ? (d) : DEPTH_BUCKETS - 1]++)
+#else
+#define STAT_INC(field) ((void)0)
+#define STAT_DEPTH(d) ((void)0)
+#endif
+
 /* Create a new node */
 struct Node* newNode(int key) {
     struct Node* n = (struct Node*)malloc(sizeof(struct Node));
     if (!n) { perror("malloc"); exit(1); }
+    STAT_INC(allocs);
+    n->key = key;
+    n->left = n->right = NULL;
+    return n;
+}
+
+/* Node arena: slab allocator for trees owned by a single thread. Nodes are
+   carved from large chunks and freed nodes are chained through ->left and
+   reused first, so a busy tree neither calls malloc per insert nor
+   scatters its nodes across the heap. Not thread-safe by design. */
+#define ARENA_CHUNK_NODES 4096
+
+struct ArenaChunk {
+    struct ArenaChunk *next;
+    struct Node nodes[ARENA_CHUNK_NODES];
+};
+
+struct NodeArena {
+    struct ArenaChunk *chunks;
+    int used;                 /* nodes handed out from chunks->nodes */
+    struct Node *free_list;
+    long live;
+};
+
+void arena_init(struct NodeArena *a) {
+    a->chunks = NULL;
+    a->used = ARENA_CHUNK_NODES;
+    a->free_list = NULL;
+    a->live = 0;
+}
+
+struct Node* arena_alloc(struct NodeArena *a, int key) {
+    struct Node *n = a->free_list;
+    if (n) {
+        a->free_list = n->left;
+    } else {
+        if (a->used == ARENA_CHUNK_NODES) {
+            struct ArenaChunk *c = (struct ArenaChunk*)malloc(sizeof(struct ArenaChunk));
+            if (!c) { perror("malloc"); exit(1); }
+            c->next = a->chunks;
+            a->chunks = c;
+            a->used = 0;
+        }
+        n = &a->chunks->nodes[a->used++];
+    }
+    STAT_INC(allocs);
+    a->live++;
     n->key = key;
     n->left = n->right = NULL;
     return n;
 }
 
+void arena_free(struct NodeArena *a, struct Node *n) {
+    n->left = a->free_list;
+    a->free_list = n;
+    a->live--;
+}
+
+/* Release every chunk; all trees built from the arena become invalid */
+void arena_destroy(struct NodeArena *a) {
+    while (a->chunks) {
+        struct ArenaChunk *next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+    arena_init(a);
+}
+
+/* Allocate/free through the arena when given, else through malloc */
+static struct Node* node_alloc(struct NodeArena *a, int key) {
+    return a ? arena_alloc(a, key) : newNode(key);
+}
+
+static void node_free(struct NodeArena *a, struct Node *n) {
+    STAT_INC(frees);
+    if (a) arena_free(a, n);
+    else free(n);
+}
+
 /* Recursive insert */
-struct Node* insert_recursive(struct Node* root, int key) {
-    if (root == NULL) return newNode(key);
-    if (key < root->key) root->left = insert_recursive(root->left, key);
-    else if (key > root->key) root->right = insert_recursive(root->right, key);
-    /* if equal, ignore duplicate */
+static struct Node* insert_rec(struct Node* root, int key, int depth) {
+    if (root == NULL) { STAT_DEPTH(depth); return newNode(key); }
+    STAT_INC(cmp_insert);
+    if (key < root->key) root->left = insert_rec(root->left, key, depth + 1);
+    else if (key > root->key) root->right = insert_rec(root->right, key, depth + 1);
+    else STAT_DEPTH(depth + 1); /* if equal, ignore duplicate */
     return root;
 }
 
+struct Node* insert_recursive(struct Node* root, int key) {
+    STAT_INC(inserts);
+    return insert_rec(root, key, 0);
+}
+
+/* Descent shared by the iterative inserts: the empty link where key
+   belongs, or NULL if key is already in the tree */
+static struct Node** insert_link(struct Node **link, int key) {
+    int depth = 0;
+    while (*link) {
+        depth++;
+        STAT_INC(cmp_insert);
+        if (key < (*link)->key) link = &(*link)->left;
+        else if (key > (*link)->key) link = &(*link)->right;
+        else { STAT_DEPTH(depth); return NULL; } /* duplicate */
+    }
+    STAT_DEPTH(depth);
+    (void)depth;
+    return link;
+}
+
 /* Iterative insert */
 struct Node* insert_iterative(struct Node* root, int key) {
-    if (root == NULL) return newNode(key);
-    struct Node* cur = root;
-    struct Node* parent = NULL;
-    while (cur) {
-        parent = cur;
-        if (key < cur->key) cur = cur->left;
-        else if (key > cur->key) cur = cur->right;
-        else return root; /* duplicate */
-    }
-    if (key < parent->key) parent->left = newNode(key);
-    else parent->right = newNode(key);
+    STAT_INC(inserts);
+    struct Node **link = insert_link(&root, key);
+    if (link) *link = newNode(key);
     return root;
 }
 
 /* Search recursively */
+static struct Node* search_rec(struct Node* root, int key, int depth) {
+    if (root == NULL) { STAT_DEPTH(depth); return NULL; }
+    STAT_INC(cmp_search);
+    if (root->key == key) { STAT_DEPTH(depth + 1); return root; }
+    if (key < root->key) return search_rec(root->left, key, depth + 1);
+    else return search_rec(root->right, key, depth + 1);
+}
+
 struct Node* search_recursive(struct Node* root, int key) {
-    if (root == NULL || root->key == key) return root;
-    if (key < root->key) return search_recursive(root->left, key);
-    else return search_recursive(root->right, key);
+    STAT_INC(searches);
+    return search_rec(root, key, 0);
+}
+
+/* Search iteratively */
+struct Node* search_iterative(struct Node* root, int key) {
+    int depth = 0;
+    STAT_INC(searches);
+    while (root) {
+        depth++;
+        STAT_INC(cmp_search);
+        if (root->key == key) break;
+        root = (key < root->key) ? root->left : root->right;
+    }
+    STAT_DEPTH(depth);
+    (void)depth;
+    return root;
 }
 
 /* Minimum value node */
@@ -69,29 +234,52 @@ struct Node* minValueNode(struct Node* node) {
 }
 
 /* Delete node */
-struct Node* deleteNode(struct Node* root, int key) {
-    if (root == NULL) return root;
-    if (key < root->key) root->left = deleteNode(root->left, key);
-    else if (key > root->key) root->right = deleteNode(root->right, key);
+static struct Node* delete_rec(struct Node* root, int key, int depth, struct NodeArena *a) {
+    if (root == NULL) { STAT_DEPTH(depth); return root; }
+    STAT_INC(cmp_delete);
+    if (key < root->key) root->left = delete_rec(root->left, key, depth + 1, a);
+    else if (key > root->key) root->right = delete_rec(root->right, key, depth + 1, a);
     else {
         /* Node with only one child or no child */
         if (root->left == NULL) {
             struct Node* temp = root->right;
-            free(root);
+            STAT_DEPTH(depth + 1);
+            node_free(a, root);
             return temp;
         } else if (root->right == NULL) {
             struct Node* temp = root->left;
-            free(root);
+            STAT_DEPTH(depth + 1);
+            node_free(a, root);
             return temp;
         }
-        /* Node with two children */
+        /* Node with two children: the successor is removed further down */
         struct Node* temp = minValueNode(root->right);
         root->key = temp->key;
-        root->right = deleteNode(root->right, temp->key);
+        root->right = delete_rec(root->right, temp->key, depth + 1, a);
     }
     return root;
 }
 
+struct Node* deleteNode(struct Node* root, int key) {
+    STAT_INC(deletes);
+    return delete_rec(root, key, 0, NULL);
+}
+
+/* deleteNode for trees whose nodes come from an arena */
+struct Node* deleteNode_arena(struct NodeArena *a, struct Node* root, int key) {
+    STAT_INC(deletes);
+    return delete_rec(root, key, 0, a);
+}
+
+/* Iterative insert from an arena; *added tells whether key was new */
+struct Node* insert_arena(struct NodeArena *a, struct Node* root, int key, int *added) {
+    STAT_INC(inserts);
+    struct Node **link = insert_link(&root, key);
+    *added = link != NULL;
+    if (link) *link = node_alloc(a, key);
+    return root;
+}
+
 /* Traversals */
 void inorder(struct Node* root) {
     if (!root) return;
@@ -114,12 +302,31 @@ void postorder(struct Node* root) {
     printf("%d ", root->key);
 }
 
-/* Get height */
+/* Get height. Uses an explicit stack since degenerate trees can be very deep. */
 int height(struct Node* root) {
-    if (!root) return 0;
-    int lh = height(root->left);
-    int rh = height(root->right);
-    return (lh > rh ? lh : rh) + 1;
+    struct HeightFrame { struct Node *node; int depth; } *stack = NULL;
+    int len = 0, cap = 0, h = 0;
+    if (root) {
+        stack = (struct HeightFrame*)malloc(64 * sizeof(*stack));
+        if (!stack) { perror("malloc"); exit(1); }
+        cap = 64;
+        stack[len].node = root;
+        stack[len++].depth = 1;
+    }
+    while (len) {
+        struct HeightFrame f = stack[--len];
+        if (f.depth > h) h = f.depth;
+        if (len + 2 > cap) {
+            cap *= 2;
+            struct HeightFrame *ns = (struct HeightFrame*)realloc(stack, cap * sizeof(*ns));
+            if (!ns) { perror("realloc"); exit(1); }
+            stack = ns;
+        }
+        if (f.node->left) { stack[len].node = f.node->left; stack[len++].depth = f.depth + 1; }
+        if (f.node->right) { stack[len].node = f.node->right; stack[len++].depth = f.depth + 1; }
+    }
+    free(stack);
+    return h;
 }
 
 /* Count nodes */
@@ -214,6 +421,80 @@ struct Node* successor(struct Node* root, int key) {
     return succ;
 }
 
+/* Predecessor and successor in a single descent. match is the node holding
+   key, if present; floor/ceiling are then match itself, otherwise the
+   predecessor/successor of the absent key. */
+struct Neighbors {
+    struct Node *pred;
+    struct Node *match;
+    struct Node *succ;
+};
+
+struct Node* nb_floor(const struct Neighbors *nb) { return nb->match ? nb->match : nb->pred; }
+struct Node* nb_ceiling(const struct Neighbors *nb) { return nb->match ? nb->match : nb->succ; }
+
+/* Finish a descent that stopped on the key: the neighbours are then the
+   extremes of its subtrees, when those exist */
+static void neighbors_finish(struct Neighbors *nb) {
+    struct Node *m = nb->match;
+    if (!m) return;
+    if (m->left) {
+        struct Node *p = m->left;
+        while (p->right) p = p->right;
+        nb->pred = p;
+    }
+    if (m->right) {
+        struct Node *q = m->right;
+        while (q->left) q = q->left;
+        nb->succ = q;
+    }
+}
+
+struct Neighbors neighbors(struct Node* root, int key) {
+    struct Neighbors nb = {NULL, NULL, NULL};
+    struct Node* cur = root;
+    while (cur) {
+        if (key < cur->key) { nb.succ = cur; cur = cur->left; }
+        else if (key > cur->key) { nb.pred = cur; cur = cur->right; }
+        else { nb.match = cur; break; }
+    }
+    neighbors_finish(&nb);
+    return nb;
+}
+
+/* neighbors() for many keys. Descents run in groups of NB_GROUP, one level
+   per round with the next node prefetched, so the cache misses of
+   independent lookups overlap instead of being paid one after another. */
+#define NB_GROUP 8
+
+void neighbors_batch(struct Node* root, const int *keys, int n, struct Neighbors *out) {
+    for (int base = 0; base < n; base += NB_GROUP) {
+        int g = n - base < NB_GROUP ? n - base : NB_GROUP;
+        struct Node *cur[NB_GROUP];
+        int live = 0;
+        for (int j = 0; j < g; ++j) {
+            out[base + j].pred = out[base + j].match = out[base + j].succ = NULL;
+            cur[j] = root;
+            live += root != NULL;
+        }
+        while (live) {
+            live = 0;
+            for (int j = 0; j < g; ++j) {
+                struct Node *c = cur[j];
+                if (!c) continue;
+                struct Neighbors *nb = &out[base + j];
+                int key = keys[base + j];
+                if (key < c->key) { nb->succ = c; c = c->left; }
+                else if (key > c->key) { nb->pred = c; c = c->right; }
+                else { nb->match = c; c = NULL; }
+                cur[j] = c;
+                if (c) { __builtin_prefetch(c); live++; }
+            }
+        }
+        for (int j = 0; j < g; ++j) neighbors_finish(&out[base + j]);
+    }
+}
+
 /* Save tree to file using preorder with marker for NULL */
 void save_tree_preorder(FILE *fp, struct Node* root) {
     if (root == NULL) {
@@ -237,36 +518,430 @@ struct Node* load_tree_preorder(FILE *fp) {
     return root;
 }
 
-/* Free tree memory */
+/* ---------- Bulk deletion ----------
+ * delete_range and delete_if remove every matching node in one pass.
+ * delete_range splits the tree at lo and hi: the nodes outside the range
+ * keep their places and whole in-range subtrees are freed, in
+ * O(height + removed). delete_if must test every key; below each matching
+ * node it flattens the subtree (survivors kept in key order, matches
+ * freed) and rebuilds it perfectly balanced from the same nodes, so a
+ * sweep never leaves the chains repeated deleteNode calls do. Subtrees
+ * that contain no match keep their shape.
+ */
+struct NodeVec {
+    struct Node **items;
+    int len;
+    int cap;
+};
+
+static void nodevec_push(struct NodeVec *v, struct Node *n) {
+    if (v->len == v->cap) {
+        int ncap = v->cap ? v->cap * 2 : 64;
+        struct Node **ni = (struct Node**)realloc(v->items, ncap * sizeof(*ni));
+        if (!ni) { perror("realloc"); exit(1); }
+        v->items = ni;
+        v->cap = ncap;
+    }
+    v->items[v->len++] = n;
+}
+
+typedef int (*key_pred)(int key, void *ctx);
+
+/* In-order walk of root: nodes matching pred are freed, the rest appended
+   to out. Uses an explicit stack since degenerate trees can be very deep. */
+static int collect_survivors(struct Node *root, key_pred pred, void *ctx, struct NodeVec *out) {
+    struct NodeVec stack = {NULL, 0, 0};
+    int removed = 0;
+    struct Node *cur = root;
+    while (cur || stack.len) {
+        while (cur) { nodevec_push(&stack, cur); cur = cur->left; }
+        cur = stack.items[--stack.len];
+        struct Node *next = cur->right;
+        if (pred(cur->key, ctx)) {
+            STAT_INC(frees);
+            free(cur);
+            removed++;
+        } else {
+            nodevec_push(out, cur);
+        }
+        cur = next;
+    }
+    free(stack.items);
+    return removed;
+}
+
+/* Link sorted nodes[lo..hi) into a balanced tree */
+static struct Node* build_balanced(struct Node **nodes, int lo, int hi) {
+    if (lo >= hi) return NULL;
+    int mid = lo + (hi - lo) / 2;
+    struct Node *n = nodes[mid];
+    n->left = build_balanced(nodes, lo, mid);
+    n->right = build_balanced(nodes, mid + 1, hi);
+    return n;
+}
+
+/* Flatten root minus the matching keys and rebuild it balanced */
+static struct Node* prune_rebuild(struct Node *root, key_pred pred, void *ctx, int *removed) {
+    struct NodeVec keep = {NULL, 0, 0};
+    int r = collect_survivors(root, pred, ctx, &keep);
+    if (r) {
+        STAT_INC(rebuilds);
+        root = build_balanced(keep.items, 0, keep.len);
+    }
+    *removed += r;
+    free(keep.items);
+    return root;
+}
+
+/* Free a whole subtree (rotating, like free_tree); returns the node count */
+static int free_counted(struct Node *n) {
+    int count = 0;
+    while (n) {
+        if (n->left) {
+            struct Node *l = n->left;
+            n->left = l->right;
+            l->right = n;
+            n = l;
+        } else {
+            struct Node *r = n->right;
+            STAT_INC(frees);
+            free(n);
+            count++;
+            n = r;
+        }
+    }
+    return count;
+}
+
+/* Remove all keys in [lo, hi]. The first in-range node t on the search
+   path splits the work: in t->left every node >= lo goes, together with
+   its right subtree (all of it lies in [lo, t->key)), and symmetrically in
+   t->right. The two trimmed halves are joined under the minimum of the
+   right half, so no surviving node moves down. */
+struct Node* delete_range(struct Node* root, int lo, int hi, int *removed) {
+    struct Node **link = &root;
+    int count = 0;
+    STAT_INC(deletes);
+    while (*link && ((*link)->key < lo || (*link)->key > hi)) {
+        STAT_INC(cmp_delete);
+        link = (*link)->key < lo ? &(*link)->right : &(*link)->left;
+    }
+    struct Node *t = *link;
+    if (t && lo <= hi) {
+        struct Node **l = &t->left, **r = &t->right;
+        while (*l) {
+            struct Node *d = *l;
+            STAT_INC(cmp_delete);
+            if (d->key < lo) { l = &d->right; continue; }
+            *l = d->left;
+            count += free_counted(d->right) + 1;
+            STAT_INC(frees);
+            free(d);
+        }
+        while (*r) {
+            struct Node *d = *r;
+            STAT_INC(cmp_delete);
+            if (d->key > hi) { r = &d->left; continue; }
+            *r = d->right;
+            count += free_counted(d->left) + 1;
+            STAT_INC(frees);
+            free(d);
+        }
+        struct Node *left = t->left, *right = t->right;
+        STAT_INC(frees);
+        free(t);
+        count++;
+        if (!left || !right) {
+            *link = left ? left : right;
+        } else {
+            /* the right half's minimum becomes the join point */
+            struct Node **m = &right;
+            while ((*m)->left) m = &(*m)->left;
+            struct Node *j = *m;
+            *m = j->right;
+            j->left = left;
+            j->right = right;
+            *link = j;
+        }
+    }
+    if (removed) *removed = count;
+    return root;
+}
+
+/* Remove every key for which pred(key, ctx) is non-zero, in one traversal.
+   Non-matching nodes stay where they are; each matching node's subtree is
+   flattened and rebuilt on its own. */
+struct Node* delete_if(struct Node* root, key_pred pred, void *ctx, int *removed) {
+    struct NodeVec stack = {NULL, 0, 0};
+    int count = 0;
+    STAT_INC(deletes);
+    if (root && pred(root->key, ctx)) root = prune_rebuild(root, pred, ctx, &count);
+    else if (root) nodevec_push(&stack, root);
+    while (stack.len) {
+        struct Node *n = stack.items[--stack.len];
+        struct Node **child[2] = {&n->left, &n->right};
+        for (int c = 0; c < 2; ++c) {
+            if (!*child[c]) continue;
+            if (pred((*child[c])->key, ctx)) *child[c] = prune_rebuild(*child[c], pred, ctx, &count);
+            else nodevec_push(&stack, *child[c]);
+        }
+    }
+    free(stack.items);
+    if (removed) *removed = count;
+    return root;
+}
+
+/* m == 1 and m == -1 match every key; testing key % -1 would trap on INT_MIN */
+static int multiple_of(int key, void *ctx) {
+    int m = *(int*)ctx;
+    if (m == 1 || m == -1) return 1;
+    return m != 0 && key % m == 0;
+}
+
+/* Free tree memory. Left children are rotated up until the root has none,
+   so the walk needs neither recursion nor a stack. */
 void free_tree(struct Node* root) {
-    if (!root) return;
-    free_tree(root->left);
-    free_tree(root->right);
-    free(root);
+    while (root) {
+        if (root->left) {
+            struct Node *l = root->left;
+            root->left = l->right;
+            l->right = root;
+            root = l;
+        } else {
+            struct Node *r = root->right;
+            STAT_INC(frees);
+            free(root);
+            root = r;
+        }
+    }
 }
 
-/* Menu driver */
-int main(void) {
-    struct Node* root = NULL;
-    int choice;
+/* ---------- Persistent (copy-on-write) versions ----------
+ * Every update copies only the root-to-target path and shares all other
+ * subtrees with the previous version. Nodes are reference counted, so a
+ * version stays valid for as long as someone holds its root.
+ */
+struct PNode {
     int key;
-    char fname[128];
+    atomic_int refcnt;
+    struct PNode *left;
+    struct PNode *right;
+};
 
-    printf("=== Extended BST Program ===\n");
+/* Create a persistent node. Takes ownership of the references to left/right. */
+struct PNode* pnode_new(int key, struct PNode *left, struct PNode *right) {
+    struct PNode* n = (struct PNode*)malloc(sizeof(struct PNode));
+    if (!n) { perror("malloc"); exit(1); }
+    n->key = key;
+    atomic_init(&n->refcnt, 1);
+    n->left = left;
+    n->right = right;
+    return n;
+}
+
+struct PNode* pnode_retain(struct PNode *n) {
+    if (n) atomic_fetch_add_explicit(&n->refcnt, 1, memory_order_relaxed);
+    return n;
+}
+
+/* Drop one reference; frees the node (and releases its children) on the last one.
+   Dead nodes whose left child is still to be released are chained through
+   their right field, so chains of any depth need no recursion. */
+void pnode_release(struct PNode *n) {
+    struct PNode *pending = NULL;
+    for (;;) {
+        while (n && atomic_fetch_sub_explicit(&n->refcnt, 1, memory_order_acq_rel) == 1) {
+            struct PNode *r = n->right;
+            n->right = pending;
+            pending = n;
+            n = r;
+        }
+        if (!pending) return;
+        struct PNode *dead = pending;
+        pending = dead->right;
+        n = dead->left;
+        free(dead);
+    }
+}
+
+struct PNode* p_search(struct PNode* root, int key) {
+    while (root && root->key != key)
+        root = (key < root->key) ? root->left : root->right;
+    return root;
+}
+
+/* Return a new version with key inserted; root is left untouched.
+   The result is a new reference owned by the caller. Like insert_iterative
+   but copying each node on the way down: the copies are linked through
+   link and share the untouched sibling subtrees with root. */
+struct PNode* p_insert(struct PNode* root, int key) {
+    if (p_search(root, key)) return pnode_retain(root); /* duplicate: share the whole version */
+    struct PNode *out = NULL, **link = &out;
+    struct PNode *cur = root;
+    while (cur) {
+        struct PNode *n;
+        if (key < cur->key) {
+            n = pnode_new(cur->key, NULL, pnode_retain(cur->right));
+            *link = n;
+            link = &n->left;
+            cur = cur->left;
+        } else {
+            n = pnode_new(cur->key, pnode_retain(cur->left), NULL);
+            *link = n;
+            link = &n->right;
+            cur = cur->right;
+        }
+    }
+    *link = pnode_new(key, NULL, NULL);
+    return out;
+}
+
+/* Return a new version with key removed; root is left untouched.
+   A missing key shares the whole version instead of copying a path. */
+struct PNode* p_delete(struct PNode* root, int key) {
+    struct PNode *t = p_search(root, key);
+    if (!t) return pnode_retain(root);
+    struct PNode *out = NULL, **link = &out;
+    for (struct PNode *cur = root; cur != t; ) {
+        struct PNode *n;
+        if (key < cur->key) {
+            n = pnode_new(cur->key, NULL, pnode_retain(cur->right));
+            *link = n;
+            link = &n->left;
+            cur = cur->left;
+        } else {
+            n = pnode_new(cur->key, pnode_retain(cur->left), NULL);
+            *link = n;
+            link = &n->right;
+            cur = cur->right;
+        }
+    }
+    if (t->left == NULL) { *link = pnode_retain(t->right); return out; }
+    if (t->right == NULL) { *link = pnode_retain(t->left); return out; }
+    /* two children: t's copy takes the successor's key, and the path from
+       t->right down to the successor is copied with the successor cut out */
+    struct PNode *m = t->right;
+    while (m->left) m = m->left;
+    struct PNode *n = pnode_new(m->key, pnode_retain(t->left), NULL);
+    *link = n;
+    link = &n->right;
+    for (struct PNode *cur = t->right; cur != m; cur = cur->left) {
+        n = pnode_new(cur->key, NULL, pnode_retain(cur->right));
+        *link = n;
+        link = &n->left;
+    }
+    *link = pnode_retain(m->right);
+    return out;
+}
+
+/* Build a persistent version holding the same shape as a mutable tree */
+struct PNode* pnode_from_tree(struct Node* root) {
+    if (!root) return NULL;
+    return pnode_new(root->key, pnode_from_tree(root->left), pnode_from_tree(root->right));
+}
+
+void p_inorder(struct PNode* root) {
+    if (!root) return;
+    p_inorder(root->left);
+    printf("%d ", root->key);
+    p_inorder(root->right);
+}
+
+/* Same format as save_tree_preorder, so load_tree_preorder reads it back */
+void save_version_preorder(FILE *fp, struct PNode* root) {
+    if (root == NULL) {
+        fprintf(fp, "# ");
+        return;
+    }
+    fprintf(fp, "%d ", root->key);
+    save_version_preorder(fp, root->left);
+    save_version_preorder(fp, root->right);
+}
+
+/* Holder for the latest version. Writers are serialised by write_lock and
+   build the next version without blocking readers; pub_lock only guards the
+   pointer swap / retain, so pinning never waits for a write in progress. */
+struct VersionedTree {
+    pthread_mutex_t write_lock;
+    pthread_mutex_t pub_lock;
+    struct PNode *current;
+    unsigned long version;
+};
+
+void vt_init(struct VersionedTree *vt) {
+    pthread_mutex_init(&vt->write_lock, NULL);
+    pthread_mutex_init(&vt->pub_lock, NULL);
+    vt->current = NULL;
+    vt->version = 0;
+}
+
+void vt_destroy(struct VersionedTree *vt) {
+    pnode_release(vt->current);
+    vt->current = NULL;
+    pthread_mutex_destroy(&vt->pub_lock);
+    pthread_mutex_destroy(&vt->write_lock);
+}
+
+/* Install next as the current version (takes ownership of next) */
+static void vt_publish(struct VersionedTree *vt, struct PNode *next) {
+    pthread_mutex_lock(&vt->pub_lock);
+    struct PNode *old = vt->current;
+    vt->current = next;
+    vt->version++;
+    pthread_mutex_unlock(&vt->pub_lock);
+    pnode_release(old);
+}
+
+void vt_insert(struct VersionedTree *vt, int key) {
+    pthread_mutex_lock(&vt->write_lock);
+    vt_publish(vt, p_insert(vt->current, key));
+    pthread_mutex_unlock(&vt->write_lock);
+}
+
+void vt_delete(struct VersionedTree *vt, int key) {
+    pthread_mutex_lock(&vt->write_lock);
+    vt_publish(vt, p_delete(vt->current, key));
+    pthread_mutex_unlock(&vt->write_lock);
+}
+
+/* Replace the current version with a copy of a mutable tree */
+void vt_import(struct VersionedTree *vt, struct Node *root) {
+    pthread_mutex_lock(&vt->write_lock);
+    vt_publish(vt, pnode_from_tree(root));
+    pthread_mutex_unlock(&vt->write_lock);
+}
+
+/* Pin the current version. The returned root is immutable and may be read
+   without any locking until released with vt_unpin. */
+struct PNode* vt_pin(struct VersionedTree *vt, unsigned long *version) {
+    pthread_mutex_lock(&vt->pub_lock);
+    struct PNode *snap = pnode_retain(vt->current);
+    if (version) *version = vt->version;
+    pthread_mutex_unlock(&vt->pub_lock);
+    return snap;
+}
+
+void vt_unpin(struct PNode *snap) {
+    pnode_release(snap);
+}
+
+/* Interactive driver for the versioned tree */
+void versions_menu(struct VersionedTree *vt, struct Node *root) {
+    struct PNode *pinned = NULL;
+    unsigned long pinned_ver = 0;
+    int choice, key;
+    char fname[128];
 
     while (1) {
-        printf("\nMenu:\n");
-        printf("1. Insert (recursive)\n");
-        printf("2. Insert (iterative)\n");
-        printf("3. Search\n");
-        printf("4. Delete\n");
-        printf("5. Traversals (in/pre/post/level)\n");
-        printf("6. Statistics (height, nodes, leaves)\n");
-        printf("7. Find predecessor & successor\n");
-        printf("8. Save tree to file\n");
-        printf("9. Load tree from file (overwrites current)\n");
-        printf("10. Clear tree\n");
-        printf("11. Exit\n");
+        printf("\nVersions (current v%lu%s):\n", vt->version, pinned ? ", one pinned" : "");
+        printf("1. Import current tree as new version\n");
+        printf("2. Insert key (new version)\n");
+        printf("3. Delete key (new version)\n");
+        printf("4. Pin current version\n");
+        printf("5. Show current and pinned versions\n");
+        printf("6. Save pinned version to file\n");
+        printf("7. Release pinned version\n");
+        printf("8. Back\n");
         printf("Choice: ");
         if (scanf("%d", &choice) != 1) {
             int c;
@@ -275,77 +950,2743 @@ int main(void) {
         }
 
         if (choice == 1) {
-            printf("Enter key to insert: ");
-            if (scanf("%d", &key) == 1) root = insert_recursive(root, key);
+            vt_import(vt, root);
+            printf("Imported as v%lu\n", vt->version);
         } else if (choice == 2) {
-            printf("Enter key to insert (iterative): ");
-            if (scanf("%d", &key) == 1) root = insert_iterative(root, key);
+            printf("Enter key to insert: ");
+            if (scanf("%d", &key) == 1) vt_insert(vt, key);
         } else if (choice == 3) {
-            printf("Enter key to search: ");
-            if (scanf("%d", &key) == 1) {
-                struct Node* found = search_recursive(root, key);
-                if (found) printf("Found key %d\n", found->key);
-                else printf("Key %d not found\n", key);
-            }
-        } else if (choice == 4) {
             printf("Enter key to delete: ");
-            if (scanf("%d", &key) == 1) {
-                root = deleteNode(root, key);
-                printf("Deleted (if existed) %d\n", key);
-            }
+            if (scanf("%d", &key) == 1) vt_delete(vt, key);
+        } else if (choice == 4) {
+            vt_unpin(pinned);
+            pinned = vt_pin(vt, &pinned_ver);
+            printf("Pinned v%lu\n", pinned_ver);
         } else if (choice == 5) {
-            printf("Inorder: ");
-            inorder(root);
-            printf("\nPreorder: ");
-            preorder(root);
-            printf("\nPostorder: ");
-            postorder(root);
-            printf("\nLevel-order: ");
-            levelOrder(root);
+            unsigned long ver;
+            struct PNode *cur = vt_pin(vt, &ver);
+            printf("Current v%lu: ", ver);
+            p_inorder(cur);
+            vt_unpin(cur);
+            if (pinned) {
+                printf("\nPinned  v%lu: ", pinned_ver);
+                p_inorder(pinned);
+            }
             printf("\n");
         } else if (choice == 6) {
-            printf("Height: %d\n", height(root));
-            printf("Nodes: %d\n", count_nodes(root));
-            printf("Leaves: %d\n", count_leaves(root));
-        } else if (choice == 7) {
-            printf("Enter key to find pred & succ: ");
-            if (scanf("%d", &key) == 1) {
-                struct Node* pred = predecessor(root, key);
-                struct Node* succ = successor(root, key);
-                if (pred) printf("Predecessor: %d\n", pred->key); else printf("No predecessor\n");
-                if (succ) printf("Successor: %d\n", succ->key); else printf("No successor\n");
-            }
-        } else if (choice == 8) {
+            if (!pinned) { printf("No pinned version\n"); continue; }
             printf("Enter filename to save: ");
             if (scanf("%127s", fname) == 1) {
                 FILE *fp = fopen(fname, "w");
                 if (!fp) { printf("Failed to open file\n"); }
-                else { save_tree_preorder(fp, root); fclose(fp); printf("Saved\n"); }
-            }
-        } else if (choice == 9) {
-            printf("Enter filename to load: ");
-            if (scanf("%127s", fname) == 1) {
-                FILE *fp = fopen(fname, "r");
-                if (!fp) { printf("Failed to open file\n"); }
-                else {
-                    free_tree(root);
-                    root = load_tree_preorder(fp);
-                    fclose(fp);
-                    printf("Loaded tree from %s\n", fname);
-                }
+                else { save_version_preorder(fp, pinned); fclose(fp); printf("Saved v%lu\n", pinned_ver); }
             }
-        } else if (choice == 10) {
-            free_tree(root);
-            root = NULL;
-            printf("Cleared tree\n");
-        } else if (choice == 11) {
-            printf("Exiting.\n");
-            break;
+        } else if (choice == 7) {
+            vt_unpin(pinned);
+            pinned = NULL;
+            printf("Released\n");
+        } else if (choice == 8) {
+            break;
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+    vt_unpin(pinned);
+}
+
+/* ---------- Finger search ----------
+ * A finger remembers the root-to-node path of the last access together with
+ * the open key interval (lo, hi) each subtree on that path covers. The next
+ * operation climbs only until the interval contains the new key and
+ * descends from there, so a key close to the previous one is found after a
+ * short climb instead of a full descent from the root.
+ *
+ * Leaf inserts keep the path valid. Anything that frees or moves nodes
+ * (delete, clear, load) must call finger_reset.
+ */
+struct FingerFrame {
+    struct Node *node;
+    long long lo, hi; /* keys of node's subtree lie strictly inside (lo, hi) */
+};
+
+struct Finger {
+    struct Node *root;
+    struct FingerFrame *path;
+    int depth;
+    int cap;
+};
+
+void finger_init(struct Finger *f) {
+    f->root = NULL;
+    f->path = NULL;
+    f->depth = f->cap = 0;
+}
+
+void finger_reset(struct Finger *f) {
+    f->root = NULL;
+    f->depth = 0;
+}
+
+void finger_free(struct Finger *f) {
+    free(f->path);
+    finger_init(f);
+}
+
+static void finger_push(struct Finger *f, struct Node *n, long long lo, long long hi) {
+    if (f->depth == f->cap) {
+        int ncap = f->cap ? f->cap * 2 : 64;
+        struct FingerFrame *np = (struct FingerFrame*)realloc(f->path, ncap * sizeof(*np));
+        if (!np) { perror("realloc"); exit(1); }
+        f->path = np;
+        f->cap = ncap;
+    }
+    f->path[f->depth].node = n;
+    f->path[f->depth].lo = lo;
+    f->path[f->depth].hi = hi;
+    f->depth++;
+}
+
+/* Climb to the deepest remembered subtree whose interval contains key */
+static void finger_climb(struct Finger *f, struct Node *root, int key) {
+    if (f->root != root || f->depth == 0) {
+        f->root = root;
+        f->depth = 0;
+        if (root) finger_push(f, root, LLONG_MIN, LLONG_MAX);
+        return;
+    }
+    while (f->depth > 1) {
+        struct FingerFrame *top = &f->path[f->depth - 1];
+        if (key > top->lo && key < top->hi) break;
+        f->depth--;
+    }
+}
+
+/* Descend from the top of the path; leaves the path ending at the match
+   or at the node where the search fell off the tree */
+static struct Node* finger_descend(struct Finger *f, int key) {
+    struct FingerFrame *top = &f->path[f->depth - 1];
+    struct Node *cur = top->node;
+    long long lo = top->lo, hi = top->hi;
+    while (cur->key != key) {
+        struct Node *next;
+        STAT_INC(cmp_search);
+        if (key < cur->key) { next = cur->left; hi = cur->key; }
+        else { next = cur->right; lo = cur->key; }
+        if (!next) { STAT_DEPTH(f->depth); return NULL; }
+        finger_push(f, next, lo, hi);
+        cur = next;
+    }
+    STAT_INC(cmp_search);
+    STAT_DEPTH(f->depth);
+    return cur;
+}
+
+struct Node* finger_search(struct Finger *f, struct Node *root, int key) {
+    STAT_INC(searches);
+    finger_climb(f, root, key);
+    if (f->depth == 0) return NULL;
+    return finger_descend(f, key);
+}
+
+/* Insert starting from the finger; same result as insert_iterative */
+struct Node* finger_insert(struct Finger *f, struct Node *root, int key) {
+    STAT_INC(inserts);
+    if (root == NULL) {
+        root = newNode(key);
+        finger_reset(f);
+        finger_climb(f, root, key);
+        return root;
+    }
+    finger_climb(f, root, key);
+    if (finger_descend(f, key)) return root; /* duplicate */
+    struct FingerFrame *top = &f->path[f->depth - 1];
+    struct Node *parent = top->node;
+    struct Node *n = newNode(key);
+    if (key < parent->key) {
+        parent->left = n;
+        finger_push(f, n, top->lo, parent->key);
+    } else {
+        parent->right = n;
+        finger_push(f, n, parent->key, top->hi);
+    }
+    return root;
+}
+
+/* Monotonic wall clock in seconds */
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Compare root-start and finger insert/search on an ascending stream with
+   +-jitter noise on every key */
+void bench_nearly_sorted(int n, int jitter) {
+    int *keys = (int*)malloc(sizeof(int) * (size_t)n);
+    if (!keys) { perror("malloc"); exit(1); }
+    for (int i = 0; i < n; ++i)
+        keys[i] = i * 4 + (jitter > 0 ? rand() % (2 * jitter + 1) - jitter : 0);
+
+    struct Node *plain = NULL, *fing = NULL;
+    struct Finger f;
+    struct PerfCounters pc;
+    finger_init(&f);
+    perf_open(&pc);
+    int hits = 0;
+    double t0, t1;
+
+    printf("n=%d jitter=%d\n", n, jitter);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) plain = insert_iterative(plain, keys[i]);
+    t1 = now_sec(); perf_stop(&pc);
+    printf("insert_iterative: %10.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "insert_iterative", n);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) fing = finger_insert(&f, fing, keys[i]);
+    t1 = now_sec(); perf_stop(&pc);
+    printf("finger_insert:    %10.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "finger_insert", n);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) hits += search_iterative(plain, keys[i]) != NULL;
+    t1 = now_sec(); perf_stop(&pc);
+    printf("search_iterative: %10.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "search_iterative", n);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) hits += finger_search(&f, fing, keys[i]) != NULL;
+    t1 = now_sec(); perf_stop(&pc);
+    printf("finger_search:    %10.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "finger_search", n);
+
+    printf("height=%d (hits %d)\n", height(plain), hits);
+    perf_close(&pc);
+    finger_free(&f);
+    free_tree(plain);
+    free_tree(fing);
+    free(keys);
+}
+
+/* ---------- Hash index for exact lookups ----------
+ * Open-addressing Robin Hood table mapping key -> tree node, kept in
+ * lockstep with the tree by indexed_insert / indexed_delete. Exact-key
+ * lookups are served from the table; ordered queries still use the tree.
+ */
+struct HashSlot {
+    int key;
+    unsigned dist;      /* probe distance + 1; 0 marks an empty slot */
+    struct Node *node;
+};
+
+struct HashIndex {
+    struct HashSlot *slots;
+    unsigned mask;      /* capacity - 1, capacity is a power of two */
+    unsigned count;
+};
+
+static unsigned hidx_hash(int key) {
+    unsigned h = (unsigned)key;
+    h ^= h >> 16; h *= 0x85ebca6bu;
+    h ^= h >> 13; h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+void hidx_init(struct HashIndex *h, unsigned capacity) {
+    unsigned cap = 16;
+    while (cap < capacity) cap <<= 1;
+    h->slots = (struct HashSlot*)calloc(cap, sizeof(struct HashSlot));
+    if (!h->slots) { perror("calloc"); exit(1); }
+    h->mask = cap - 1;
+    h->count = 0;
+}
+
+void hidx_free(struct HashIndex *h) {
+    free(h->slots);
+    h->slots = NULL;
+    h->mask = h->count = 0;
+}
+
+void hidx_clear(struct HashIndex *h) {
+    memset(h->slots, 0, (h->mask + 1) * sizeof(struct HashSlot));
+    h->count = 0;
+}
+
+struct Node* hidx_get(const struct HashIndex *h, int key) {
+    unsigned i = hidx_hash(key) & h->mask;
+    for (unsigned d = 1; ; ++d, i = (i + 1) & h->mask) {
+        const struct HashSlot *s = &h->slots[i];
+        /* Robin Hood invariant: stop once we pass slots richer than us */
+        if (s->dist < d) return NULL;
+        if (s->key == key) return s->node;
+    }
+}
+
+static void hidx_grow(struct HashIndex *h);
+
+/* Insert or update key -> node */
+void hidx_put(struct HashIndex *h, int key, struct Node *node) {
+    if ((h->count + 1) * 8 > (h->mask + 1) * 7) hidx_grow(h);
+    struct HashSlot cur = {key, 1, node};
+    unsigned i = hidx_hash(key) & h->mask;
+    for (;; cur.dist++, i = (i + 1) & h->mask) {
+        struct HashSlot *s = &h->slots[i];
+        if (s->dist == 0) { *s = cur; h->count++; return; }
+        if (s->key == cur.key) { s->node = cur.node; return; }
+        if (s->dist < cur.dist) { /* steal from the rich */
+            struct HashSlot tmp = *s;
+            *s = cur;
+            cur = tmp;
+        }
+    }
+}
+
+static void hidx_grow(struct HashIndex *h) {
+    struct HashSlot *old = h->slots;
+    unsigned old_cap = h->mask + 1;
+    hidx_init(h, old_cap * 2);
+    for (unsigned i = 0; i < old_cap; ++i)
+        if (old[i].dist) hidx_put(h, old[i].key, old[i].node);
+    free(old);
+}
+
+/* Remove key; backward-shift deletion keeps probe sequences tombstone-free */
+void hidx_erase(struct HashIndex *h, int key) {
+    unsigned i = hidx_hash(key) & h->mask;
+    for (unsigned d = 1; ; ++d, i = (i + 1) & h->mask) {
+        struct HashSlot *s = &h->slots[i];
+        if (s->dist < d) return;
+        if (s->key == key) break;
+    }
+    for (;;) {
+        unsigned next = (i + 1) & h->mask;
+        struct HashSlot *n = &h->slots[next];
+        if (n->dist <= 1) { h->slots[i].dist = 0; break; }
+        h->slots[i] = *n;
+        h->slots[i].dist--;
+        i = next;
+    }
+    h->count--;
+}
+
+static void hidx_add_subtree(struct HashIndex *h, struct Node *n) {
+    if (!n) return;
+    hidx_put(h, n->key, n);
+    hidx_add_subtree(h, n->left);
+    hidx_add_subtree(h, n->right);
+}
+
+/* Re-synchronise after operations that bypass the indexed_* wrappers */
+void hidx_rebuild(struct HashIndex *h, struct Node *root) {
+    hidx_clear(h);
+    hidx_add_subtree(h, root);
+}
+
+/* Iterative insert that also records the new node in the index */
+struct Node* indexed_insert(struct Node* root, struct HashIndex *h, int key) {
+    if (hidx_get(h, key)) return root; /* duplicate, no descent needed */
+    struct Node **link = &root;
+    while (*link) link = (key < (*link)->key) ? &(*link)->left : &(*link)->right;
+    *link = newNode(key);
+    hidx_put(h, key, *link);
+    return root;
+}
+
+/* deleteNode that keeps the index in step. A two-child delete moves the
+   successor's key into the deleted key's node, so that entry is repointed. */
+struct Node* indexed_delete(struct Node* root, struct HashIndex *h, int key) {
+    struct Node *n = hidx_get(h, key);
+    if (!n) return root; /* absent, no descent needed */
+    hidx_erase(h, key);
+    if (n->left && n->right) {
+        int succ = minValueNode(n->right)->key;
+        root = deleteNode(root, key);
+        hidx_put(h, succ, n);
+    } else {
+        root = deleteNode(root, key);
+    }
+    return root;
+}
+
+struct Node* indexed_search(const struct HashIndex *h, int key) {
+    STAT_INC(searches);
+    return hidx_get(h, key);
+}
+
+/* Exact-key lookups in random order: tree descent vs. hash index */
+void bench_exact_lookups(int n) {
+    struct Node *root = NULL;
+    struct HashIndex h;
+    struct PerfCounters pc;
+    int *keys = (int*)malloc(sizeof(int) * (size_t)n);
+    if (!keys) { perror("malloc"); exit(1); }
+    hidx_init(&h, (unsigned)n);
+    perf_open(&pc);
+    for (int i = 0; i < n; ++i) {
+        keys[i] = rand();
+        root = indexed_insert(root, &h, keys[i]);
+    }
+    long hits = 0;
+    double t0, t1;
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) hits += search_recursive(root, keys[(i * 7919L) % n]) != NULL;
+    t1 = now_sec(); perf_stop(&pc);
+    printf("search_recursive: %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "search_recursive", n);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) hits += indexed_search(&h, keys[(i * 7919L) % n]) != NULL;
+    t1 = now_sec(); perf_stop(&pc);
+    printf("indexed_search:   %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "indexed_search", n);
+
+    printf("n=%d height=%d (hits %ld)\n", n, height(root), hits);
+    perf_close(&pc);
+    hidx_free(&h);
+    free_tree(root);
+    free(keys);
+}
+
+/* ---------- Blocked Bloom filter for negative lookups ----------
+ * Each key hashes to one 64-byte block (a single cache line) and sets
+ * BLOOM_K bits inside it, so a definite miss costs one line fetch instead
+ * of a root-to-leaf descent. Deleted keys cannot be cleared; they only raise
+ * the false positive rate until bloom_rebuild re-sizes and re-fills the
+ * filter from the tree. That happens after bulk operations, and through
+ * bloom_track_insert / bloom_track_delete once enough deletes have
+ * accumulated or inserts have filled the filter past its sizing.
+ */
+#define BLOOM_BLOCK_WORDS 8   /* 8 x 64 bits = 512-bit block */
+#define BLOOM_K 6
+#define BLOOM_BITS_PER_KEY 12
+
+struct BloomFilter {
+    uint64_t *blocks;
+    unsigned mask;            /* number of blocks - 1 */
+    unsigned long keys;       /* keys added since the last rebuild */
+    unsigned long stale;      /* deletes since the last rebuild */
+    unsigned long long queries, negatives, false_positives;
+};
+
+static uint64_t bloom_hash(int key) {
+    uint64_t h = (uint32_t)key;
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void bloom_init(struct BloomFilter *bf, unsigned long expected) {
+    unsigned long want = expected * BLOOM_BITS_PER_KEY / 512 + 1;
+    unsigned nblocks = 1;
+    while (nblocks < want) nblocks <<= 1;
+    bf->blocks = (uint64_t*)calloc((size_t)nblocks * BLOOM_BLOCK_WORDS, sizeof(uint64_t));
+    if (!bf->blocks) { perror("calloc"); exit(1); }
+    bf->mask = nblocks - 1;
+    bf->keys = bf->stale = 0;
+    bf->queries = bf->negatives = bf->false_positives = 0;
+}
+
+void bloom_free(struct BloomFilter *bf) {
+    free(bf->blocks);
+    bf->blocks = NULL;
+}
+
+/* The high half of the hash picks the block; bit positions come from the
+   low half (h1 = bits 0-8, h2 = bits 16-24), so the two never overlap
+   however many blocks there are */
+#define BLOOM_BLOCK(bf, h) ((bf)->blocks + (size_t)(((h) >> 32) & (bf)->mask) * BLOOM_BLOCK_WORDS)
+#define BLOOM_H2(h) ((unsigned)((h) >> 16) | 1)
+
+/* Set key's bits. Only counts the key when a bit was newly set, so adding
+   a key that is already present does not inflate keys. */
+void bloom_add(struct BloomFilter *bf, int key) {
+    uint64_t h = bloom_hash(key);
+    uint64_t *blk = BLOOM_BLOCK(bf, h);
+    unsigned h1 = (unsigned)h, h2 = BLOOM_H2(h);
+    uint64_t fresh = 0;
+    for (int i = 0; i < BLOOM_K; ++i) {
+        unsigned bit = (h1 + i * h2) & 511;
+        fresh |= ~blk[bit >> 6] & (1ULL << (bit & 63));
+        blk[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    if (fresh) bf->keys++;
+}
+
+/* 0 means key is definitely absent */
+int bloom_maybe(const struct BloomFilter *bf, int key) {
+    uint64_t h = bloom_hash(key);
+    const uint64_t *blk = BLOOM_BLOCK(bf, h);
+    unsigned h1 = (unsigned)h, h2 = BLOOM_H2(h);
+    for (int i = 0; i < BLOOM_K; ++i) {
+        unsigned bit = (h1 + i * h2) & 511;
+        if (!(blk[bit >> 6] & (1ULL << (bit & 63)))) return 0;
+    }
+    return 1;
+}
+
+void bloom_note_delete(struct BloomFilter *bf) {
+    bf->stale++;
+}
+
+/* Rebuild once deletes exceed a quarter of the keys, or the filter is full */
+int bloom_needs_rebuild(const struct BloomFilter *bf) {
+    unsigned long capacity = (unsigned long)(bf->mask + 1) * 512 / BLOOM_BITS_PER_KEY;
+    return bf->stale * 4 > bf->keys || bf->keys > capacity;
+}
+
+static void bloom_add_subtree(struct BloomFilter *bf, struct Node *n) {
+    if (!n) return;
+    bloom_add(bf, n->key);
+    bloom_add_subtree(bf, n->left);
+    bloom_add_subtree(bf, n->right);
+}
+
+/* Re-size for the current tree and re-add its keys; keeps the counters */
+void bloom_rebuild(struct BloomFilter *bf, struct Node *root) {
+    unsigned long long q = bf->queries, neg = bf->negatives, fp = bf->false_positives;
+    int n = count_nodes(root);
+    bloom_free(bf);
+    bloom_init(bf, (unsigned long)(n < 1024 ? 1024 : n) * 2);
+    bloom_add_subtree(bf, root);
+    bf->queries = q;
+    bf->negatives = neg;
+    bf->false_positives = fp;
+}
+
+/* Keep bf in step with an insert of key into root (key already in the tree) */
+void bloom_track_insert(struct BloomFilter *bf, struct Node *root, int key) {
+    bloom_add(bf, key);
+    if (bloom_needs_rebuild(bf)) bloom_rebuild(bf, root);
+}
+
+/* Same for a delete; existed tells whether key was actually removed */
+void bloom_track_delete(struct BloomFilter *bf, struct Node *root, int existed) {
+    if (!existed) return;
+    bloom_note_delete(bf);
+    if (bloom_needs_rebuild(bf)) bloom_rebuild(bf, root);
+}
+
+/* Exact lookup behind the filter; idx may be NULL to search the tree */
+struct Node* filtered_search(struct BloomFilter *bf, struct Node *root,
+                             const struct HashIndex *idx, int key) {
+    bf->queries++;
+    if (!bloom_maybe(bf, key)) {
+        bf->negatives++;
+        return NULL;
+    }
+    struct Node *found = idx ? indexed_search(idx, key) : search_recursive(root, key);
+    if (!found) bf->false_positives++;
+    return found;
+}
+
+void bloom_report(const struct BloomFilter *bf) {
+    unsigned long long passed = bf->queries - bf->negatives;
+    printf("Filter: %u blocks (%u KiB), %lu keys, %lu stale deletes\n",
+           bf->mask + 1, (bf->mask + 1) * 64 / 1024, bf->keys, bf->stale);
+    printf("Queries: %llu  filtered out: %llu (%.1f%%)  false positives: %llu (%.2f%% of passed)\n",
+           bf->queries, bf->negatives, bf->queries ? 100.0 * bf->negatives / bf->queries : 0.0,
+           bf->false_positives, passed ? 100.0 * bf->false_positives / passed : 0.0);
+}
+
+/* Lookups that all miss: plain descent vs. filter in front of the tree */
+void bench_negative_lookups(int n) {
+    struct Node *root = NULL;
+    struct BloomFilter bf;
+    struct PerfCounters pc;
+    int *probes = (int*)malloc(sizeof(int) * (size_t)n);
+    if (!probes) { perror("malloc"); exit(1); }
+    bloom_init(&bf, (unsigned long)n);
+    perf_open(&pc);
+    for (int i = 0; i < n; ++i) { /* even keys present, odd keys missing */
+        int k = (int)(((unsigned)rand() << 1) & 0x7ffffffe);
+        root = insert_iterative(root, k);
+        bloom_track_insert(&bf, root, k);
+        probes[i] = (int)(((unsigned)rand() << 1 | 1) & 0x7fffffff);
+    }
+    long hits = 0;
+    double t0, t1;
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) hits += search_recursive(root, probes[i]) != NULL;
+    t1 = now_sec(); perf_stop(&pc);
+    printf("search_recursive: %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "search_recursive", n);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) hits += filtered_search(&bf, root, NULL, probes[i]) != NULL;
+    t1 = now_sec(); perf_stop(&pc);
+    printf("filtered_search:  %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "filtered_search", n);
+
+    printf("n=%d height=%d (hits %ld)\n", n, height(root), hits);
+    bloom_report(&bf);
+    perf_close(&pc);
+    bloom_free(&bf);
+    free_tree(root);
+    free(probes);
+}
+
+/* ---------- Sharded ordered set ----------
+ * The key space is split into ranges [lower[i], lower[i+1]), one per shard.
+ * Each shard is an ordinary tree plus node arena owned by one worker
+ * thread; clients never touch a shard's tree, they queue ShardOp requests
+ * and wait for completion. Ops on different shards run in parallel, and a
+ * worker drains its whole queue per wakeup. Range and neighbour queries
+ * fan out across shards. Updates re-cut the boundaries at key quantiles
+ * (sharded_rebalance) once the largest shard holds SHARD_SKEW_RATIO times
+ * the keys of the smallest. The shard count is capped at SHARDS_PER_CPU
+ * threads per online CPU.
+ */
+#define SHARDS_PER_CPU 4
+#define SHARD_SKEW_RATIO 4
+#define SHARD_REBALANCE_MIN 64   /* keys per shard before skew counts */
+
+struct IntVec {
+    int *items;
+    int len;
+    int cap;
+};
+
+static void intvec_push(struct IntVec *v, int x) {
+    if (v->len == v->cap) {
+        int ncap = v->cap ? v->cap * 2 : 64;
+        int *ni = (int*)realloc(v->items, ncap * sizeof(int));
+        if (!ni) { perror("realloc"); exit(1); }
+        v->items = ni;
+        v->cap = ncap;
+    }
+    v->items[v->len++] = x;
+}
+
+enum ShardOpType {
+    SOP_INSERT, SOP_DELETE, SOP_SEARCH, SOP_PRED, SOP_SUCC, SOP_RANGE,
+    SOP_INSERT_BATCH, SOP_DELETE_BATCH, SOP_SEARCH_BATCH, SOP_DRAIN, SOP_BUILD, SOP_STOP
+};
+
+struct ShardOp {
+    enum ShardOpType type;
+    int key, key2;          /* key; upper bound for SOP_RANGE */
+    const int *keys;        /* batch input */
+    int nkeys;
+    struct IntVec *out;     /* range/drain output, build input */
+    int result;             /* found/changed flag, or count for batches */
+    int value;              /* key found by pred/succ */
+    int done;
+    struct ShardOp *next;
+};
+
+struct Shard {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    struct ShardOp *head, *tail;
+    struct Node *root;          /* touched only by the worker */
+    struct NodeArena arena;     /* touched only by the worker */
+    atomic_int count;
+};
+
+struct ShardedSet {
+    int nshards;
+    struct Shard *shards;
+    int *lower;                 /* lower[0] == INT_MIN */
+    pthread_rwlock_t route_lock; /* shared by ops, exclusive for rebalance */
+    atomic_int rebalances;
+};
+
+static void range_collect(struct Node *n, int lo, int hi, struct IntVec *out) {
+    if (!n) return;
+    if (n->key > lo) range_collect(n->left, lo, hi, out);
+    if (n->key >= lo && n->key <= hi) intvec_push(out, n->key);
+    if (n->key < hi) range_collect(n->right, lo, hi, out);
+}
+
+static void shard_exec(struct Shard *sh, struct ShardOp *op) {
+    struct Node *n;
+    int added;
+    long before;
+    switch (op->type) {
+    case SOP_INSERT:
+        sh->root = insert_arena(&sh->arena, sh->root, op->key, &added);
+        op->result = added;
+        break;
+    case SOP_DELETE:
+        before = sh->arena.live;
+        sh->root = deleteNode_arena(&sh->arena, sh->root, op->key);
+        op->result = sh->arena.live != before;
+        break;
+    case SOP_SEARCH:
+        op->result = search_recursive(sh->root, op->key) != NULL;
+        break;
+    case SOP_PRED:
+    case SOP_SUCC:
+        n = op->type == SOP_PRED ? predecessor(sh->root, op->key) : successor(sh->root, op->key);
+        op->result = n != NULL;
+        if (n) op->value = n->key;
+        break;
+    case SOP_RANGE:
+        range_collect(sh->root, op->key, op->key2, op->out);
+        break;
+    case SOP_INSERT_BATCH:
+        op->result = 0;
+        for (int i = 0; i < op->nkeys; ++i) {
+            sh->root = insert_arena(&sh->arena, sh->root, op->keys[i], &added);
+            op->result += added;
+        }
+        break;
+    case SOP_DELETE_BATCH:
+        before = sh->arena.live;
+        for (int i = 0; i < op->nkeys; ++i)
+            sh->root = deleteNode_arena(&sh->arena, sh->root, op->keys[i]);
+        op->result = (int)(before - sh->arena.live);
+        break;
+    case SOP_SEARCH_BATCH:
+        op->result = 0;
+        for (int i = 0; i < op->nkeys; ++i)
+            op->result += search_recursive(sh->root, op->keys[i]) != NULL;
+        break;
+    case SOP_DRAIN: /* hand back all keys in order and empty the shard */
+        range_collect(sh->root, INT_MIN, INT_MAX, op->out);
+        arena_destroy(&sh->arena);
+        sh->root = NULL;
+        break;
+    case SOP_BUILD: { /* op->out holds sorted keys; shard must be empty */
+        struct NodeVec nodes = {NULL, 0, 0};
+        for (int i = 0; i < op->out->len; ++i)
+            nodevec_push(&nodes, arena_alloc(&sh->arena, op->out->items[i]));
+        sh->root = build_balanced(nodes.items, 0, nodes.len);
+        free(nodes.items);
+        break;
+    }
+    case SOP_STOP:
+        break;
+    }
+    atomic_store(&sh->count, (int)sh->arena.live);
+}
+
+static void* shard_worker(void *arg) {
+    struct Shard *sh = (struct Shard*)arg;
+    int running = 1;
+    while (running) {
+        pthread_mutex_lock(&sh->lock);
+        while (!sh->head) pthread_cond_wait(&sh->work_cv, &sh->lock);
+        struct ShardOp *batch = sh->head;
+        sh->head = sh->tail = NULL;
+        pthread_mutex_unlock(&sh->lock);
+
+        for (struct ShardOp *op = batch; op; op = op->next) {
+            if (op->type == SOP_STOP) running = 0;
+            else shard_exec(sh, op);
+        }
+
+        pthread_mutex_lock(&sh->lock);
+        while (batch) { /* read next first: the owner may reuse op once done */
+            struct ShardOp *next = batch->next;
+            batch->done = 1;
+            batch = next;
+        }
+        pthread_cond_broadcast(&sh->done_cv);
+        pthread_mutex_unlock(&sh->lock);
+    }
+    return NULL;
+}
+
+static void shard_submit(struct Shard *sh, struct ShardOp *op) {
+    op->done = 0;
+    op->next = NULL;
+    pthread_mutex_lock(&sh->lock);
+    if (sh->tail) sh->tail->next = op;
+    else sh->head = op;
+    sh->tail = op;
+    pthread_cond_signal(&sh->work_cv);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+static void shard_wait(struct Shard *sh, struct ShardOp *op) {
+    pthread_mutex_lock(&sh->lock);
+    while (!op->done) pthread_cond_wait(&sh->done_cv, &sh->lock);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+/* Shard owning key: last i with lower[i] <= key */
+static int shard_of(const struct ShardedSet *ss, int key) {
+    int lo = 0, hi = ss->nshards - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (ss->lower[mid] <= key) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Largest shard count sharded_init accepts */
+int sharded_max_shards(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return SHARDS_PER_CPU * (cpus > 0 ? (int)cpus : 1);
+}
+
+/* Start nshards workers with boundaries evenly spread over [key_lo, key_hi].
+   nshards is clamped to [1, sharded_max_shards()]; ss->nshards has the
+   count actually used. */
+void sharded_init(struct ShardedSet *ss, int nshards, int key_lo, int key_hi) {
+    int cap = sharded_max_shards();
+    if (nshards < 1) nshards = 1;
+    if (nshards > cap) nshards = cap;
+    ss->nshards = nshards;
+    atomic_init(&ss->rebalances, 0);
+    ss->shards = (struct Shard*)calloc(nshards, sizeof(struct Shard));
+    ss->lower = (int*)malloc(sizeof(int) * nshards);
+    if (!ss->shards || !ss->lower) { perror("malloc"); exit(1); }
+    pthread_rwlock_init(&ss->route_lock, NULL);
+    for (int i = 0; i < nshards; ++i) {
+        struct Shard *sh = &ss->shards[i];
+        ss->lower[i] = i == 0 ? INT_MIN
+                              : (int)(key_lo + ((long long)key_hi - key_lo) * i / nshards);
+        pthread_mutex_init(&sh->lock, NULL);
+        pthread_cond_init(&sh->work_cv, NULL);
+        pthread_cond_init(&sh->done_cv, NULL);
+        arena_init(&sh->arena);
+        atomic_init(&sh->count, 0);
+        if (pthread_create(&sh->thread, NULL, shard_worker, sh) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+}
+
+void sharded_destroy(struct ShardedSet *ss) {
+    struct ShardOp *stop = (struct ShardOp*)calloc(ss->nshards, sizeof(struct ShardOp));
+    if (!stop) { perror("calloc"); exit(1); }
+    for (int i = 0; i < ss->nshards; ++i) {
+        stop[i].type = SOP_STOP;
+        shard_submit(&ss->shards[i], &stop[i]);
+    }
+    for (int i = 0; i < ss->nshards; ++i) {
+        struct Shard *sh = &ss->shards[i];
+        pthread_join(sh->thread, NULL);
+        arena_destroy(&sh->arena);
+        pthread_cond_destroy(&sh->done_cv);
+        pthread_cond_destroy(&sh->work_cv);
+        pthread_mutex_destroy(&sh->lock);
+    }
+    free(stop);
+    pthread_rwlock_destroy(&ss->route_lock);
+    free(ss->shards);
+    free(ss->lower);
+    ss->shards = NULL;
+    ss->lower = NULL;
+    ss->nshards = 0;
+}
+
+/* Run one point op on the shard owning key */
+static int sharded_point(struct ShardedSet *ss, enum ShardOpType type, int key) {
+    struct ShardOp op = {0};
+    op.type = type;
+    op.key = key;
+    pthread_rwlock_rdlock(&ss->route_lock);
+    struct Shard *sh = &ss->shards[shard_of(ss, key)];
+    shard_submit(sh, &op);
+    shard_wait(sh, &op);
+    pthread_rwlock_unlock(&ss->route_lock);
+    return op.result;
+}
+
+static void sharded_maybe_rebalance(struct ShardedSet *ss);
+
+int sharded_insert(struct ShardedSet *ss, int key) {
+    int added = sharded_point(ss, SOP_INSERT, key);
+    if (added) sharded_maybe_rebalance(ss);
+    return added;
+}
+
+int sharded_delete(struct ShardedSet *ss, int key) {
+    int removed = sharded_point(ss, SOP_DELETE, key);
+    if (removed) sharded_maybe_rebalance(ss);
+    return removed;
+}
+
+int sharded_contains(struct ShardedSet *ss, int key) { return sharded_point(ss, SOP_SEARCH, key); }
+
+/* Route a batch to its shards and run the per-shard parts in parallel.
+   Returns the summed per-shard results (keys added, removed or found). */
+static int sharded_batch(struct ShardedSet *ss, enum ShardOpType type, const int *keys, int n) {
+    int ns = ss->nshards;
+    int *start = (int*)calloc(ns + 1, sizeof(int));
+    int *sorted = (int*)malloc(sizeof(int) * (size_t)(n ? n : 1));
+    struct ShardOp *ops = (struct ShardOp*)calloc(ns, sizeof(struct ShardOp));
+    if (!start || !sorted || !ops) { perror("malloc"); exit(1); }
+    int total = 0;
+
+    pthread_rwlock_rdlock(&ss->route_lock);
+    for (int i = 0; i < n; ++i) start[shard_of(ss, keys[i]) + 1]++;
+    for (int s = 0; s < ns; ++s) start[s + 1] += start[s];
+    for (int s = 0; s < ns; ++s) ops[s].nkeys = start[s];
+    for (int i = 0; i < n; ++i) sorted[ops[shard_of(ss, keys[i])].nkeys++] = keys[i];
+    for (int s = 0; s < ns; ++s) {
+        ops[s].type = type;
+        ops[s].keys = sorted + start[s];
+        ops[s].nkeys = start[s + 1] - start[s];
+        if (ops[s].nkeys) shard_submit(&ss->shards[s], &ops[s]);
+    }
+    for (int s = 0; s < ns; ++s) {
+        if (!ops[s].nkeys) continue;
+        shard_wait(&ss->shards[s], &ops[s]);
+        total += ops[s].result;
+    }
+    pthread_rwlock_unlock(&ss->route_lock);
+
+    free(ops);
+    free(sorted);
+    free(start);
+    return total;
+}
+
+int sharded_insert_batch(struct ShardedSet *ss, const int *keys, int n) {
+    int added = sharded_batch(ss, SOP_INSERT_BATCH, keys, n);
+    if (added) sharded_maybe_rebalance(ss);
+    return added;
+}
+
+int sharded_delete_batch(struct ShardedSet *ss, const int *keys, int n) {
+    int removed = sharded_batch(ss, SOP_DELETE_BATCH, keys, n);
+    if (removed) sharded_maybe_rebalance(ss);
+    return removed;
+}
+
+int sharded_search_batch(struct ShardedSet *ss, const int *keys, int n) {
+    return sharded_batch(ss, SOP_SEARCH_BATCH, keys, n);
+}
+
+/* Append all keys in [lo, hi] to out in order, querying shards in parallel */
+void sharded_range(struct ShardedSet *ss, int lo, int hi, struct IntVec *out) {
+    if (lo > hi) return;
+    pthread_rwlock_rdlock(&ss->route_lock);
+    int first = shard_of(ss, lo), last = shard_of(ss, hi);
+    int cnt = last - first + 1;
+    struct ShardOp *ops = (struct ShardOp*)calloc(cnt, sizeof(struct ShardOp));
+    struct IntVec *parts = (struct IntVec*)calloc(cnt, sizeof(struct IntVec));
+    if (!ops || !parts) { perror("calloc"); exit(1); }
+    for (int i = 0; i < cnt; ++i) {
+        ops[i].type = SOP_RANGE;
+        ops[i].key = lo;
+        ops[i].key2 = hi;
+        ops[i].out = &parts[i];
+        shard_submit(&ss->shards[first + i], &ops[i]);
+    }
+    for (int i = 0; i < cnt; ++i) {
+        shard_wait(&ss->shards[first + i], &ops[i]);
+        for (int j = 0; j < parts[i].len; ++j) intvec_push(out, parts[i].items[j]);
+        free(parts[i].items);
+    }
+    pthread_rwlock_unlock(&ss->route_lock);
+    free(parts);
+    free(ops);
+}
+
+/* Strict predecessor (dir < 0) or successor (dir > 0) of key, walking to
+   neighbouring shards while the owning shard has none */
+static int sharded_neighbour(struct ShardedSet *ss, int key, int dir, int *out) {
+    struct ShardOp op = {0};
+    int found = 0;
+    op.type = dir < 0 ? SOP_PRED : SOP_SUCC;
+    op.key = key;
+    pthread_rwlock_rdlock(&ss->route_lock);
+    for (int s = shard_of(ss, key); s >= 0 && s < ss->nshards && !found; s += dir) {
+        shard_submit(&ss->shards[s], &op);
+        shard_wait(&ss->shards[s], &op);
+        if (op.result) { *out = op.value; found = 1; }
+    }
+    pthread_rwlock_unlock(&ss->route_lock);
+    return found;
+}
+
+int sharded_pred(struct ShardedSet *ss, int key, int *out) { return sharded_neighbour(ss, key, -1, out); }
+int sharded_succ(struct ShardedSet *ss, int key, int *out) { return sharded_neighbour(ss, key, 1, out); }
+
+int sharded_size(struct ShardedSet *ss) {
+    int total = 0;
+    for (int i = 0; i < ss->nshards; ++i) total += atomic_load(&ss->shards[i].count);
+    return total;
+}
+
+/* Skewed when the largest shard holds more than SHARD_SKEW_RATIO times the
+   keys of the smallest; small sets never count as skewed */
+int sharded_is_skewed(struct ShardedSet *ss) {
+    int total = 0, max = 0, min = INT_MAX;
+    for (int i = 0; i < ss->nshards; ++i) {
+        int c = atomic_load(&ss->shards[i].count);
+        total += c;
+        if (c > max) max = c;
+        if (c < min) min = c;
+    }
+    return ss->nshards > 1 && (long long)total >= (long long)SHARD_REBALANCE_MIN * ss->nshards &&
+           max > (long long)SHARD_SKEW_RATIO * min;
+}
+
+/* Re-cut shard boundaries at key quantiles and redistribute; the caller
+   holds route_lock exclusively. Each shard rebuilds its tree balanced. */
+static void sharded_rebalance_locked(struct ShardedSet *ss) {
+    int ns = ss->nshards;
+    struct ShardOp *ops = (struct ShardOp*)calloc(ns, sizeof(struct ShardOp));
+    struct IntVec all = {NULL, 0, 0};
+    struct IntVec *parts = (struct IntVec*)calloc(ns, sizeof(struct IntVec));
+    if (!ops || !parts) { perror("calloc"); exit(1); }
+
+    for (int s = 0; s < ns; ++s) {
+        ops[s].type = SOP_DRAIN;
+        ops[s].out = &parts[s];
+        shard_submit(&ss->shards[s], &ops[s]);
+    }
+    for (int s = 0; s < ns; ++s) {
+        shard_wait(&ss->shards[s], &ops[s]);
+        for (int j = 0; j < parts[s].len; ++j) intvec_push(&all, parts[s].items[j]);
+        free(parts[s].items);
+    }
+
+    if (all.len >= ns) /* too few keys: keep the old boundaries */
+        for (int s = 1; s < ns; ++s) ss->lower[s] = all.items[(long long)all.len * s / ns];
+
+    int from = 0;
+    for (int s = 0; s < ns; ++s) {
+        int to = from;
+        while (to < all.len && (s == ns - 1 || all.items[to] < ss->lower[s + 1])) to++;
+        parts[s].items = all.items + from; /* borrowed slice */
+        parts[s].len = parts[s].cap = to - from;
+        ops[s].type = SOP_BUILD;
+        ops[s].out = &parts[s];
+        shard_submit(&ss->shards[s], &ops[s]);
+        from = to;
+    }
+    for (int s = 0; s < ns; ++s) shard_wait(&ss->shards[s], &ops[s]);
+    atomic_fetch_add(&ss->rebalances, 1);
+
+    free(all.items);
+    free(parts);
+    free(ops);
+}
+
+/* Blocks all other ops for its duration */
+void sharded_rebalance(struct ShardedSet *ss) {
+    pthread_rwlock_wrlock(&ss->route_lock);
+    sharded_rebalance_locked(ss);
+    pthread_rwlock_unlock(&ss->route_lock);
+}
+
+/* Called after updates. Skew is checked again under the exclusive lock
+   so that concurrent updaters seeing the same skew rebalance once. */
+static void sharded_maybe_rebalance(struct ShardedSet *ss) {
+    if (!sharded_is_skewed(ss)) return;
+    pthread_rwlock_wrlock(&ss->route_lock);
+    if (sharded_is_skewed(ss)) sharded_rebalance_locked(ss);
+    pthread_rwlock_unlock(&ss->route_lock);
+}
+
+void sharded_report(struct ShardedSet *ss) {
+    pthread_rwlock_rdlock(&ss->route_lock);
+    for (int i = 0; i < ss->nshards; ++i) {
+        printf("Shard %2d: keys >= %11d  count %d\n", i, ss->lower[i],
+               atomic_load(&ss->shards[i].count));
+    }
+    pthread_rwlock_unlock(&ss->route_lock);
+    printf("Total %d%s, %d rebalances so far\n", sharded_size(ss),
+           sharded_is_skewed(ss) ? " (skewed)" : "", atomic_load(&ss->rebalances));
+}
+
+/* Single arena tree vs. sharded batches on the same random keys */
+void bench_sharded(int n, int nshards) {
+    int *keys = (int*)malloc(sizeof(int) * (size_t)n);
+    if (!keys) { perror("malloc"); exit(1); }
+    for (int i = 0; i < n; ++i) keys[i] = rand();
+
+    struct NodeArena arena;
+    struct Node *root = NULL;
+    struct ShardedSet ss;
+    int added = 0, found = 0, a;
+    double t0, t1;
+
+    arena_init(&arena);
+    t0 = now_sec();
+    for (int i = 0; i < n; ++i) { root = insert_arena(&arena, root, keys[i], &a); added += a; }
+    t1 = now_sec();
+    printf("single tree insert:  %8.1f ns/op (%d keys)\n", (t1 - t0) * 1e9 / n, added);
+    t0 = now_sec();
+    for (int i = 0; i < n; ++i) found += search_recursive(root, keys[i]) != NULL;
+    t1 = now_sec();
+    printf("single tree search:  %8.1f ns/op (%d found)\n", (t1 - t0) * 1e9 / n, found);
+    arena_destroy(&arena);
+
+    sharded_init(&ss, nshards, 0, RAND_MAX);
+    t0 = now_sec();
+    added = sharded_insert_batch(&ss, keys, n);
+    t1 = now_sec();
+    nshards = ss.nshards; /* may have been capped */
+    printf("sharded insert (%d): %8.1f ns/op (%d keys)\n", nshards, (t1 - t0) * 1e9 / n, added);
+    t0 = now_sec();
+    found = sharded_search_batch(&ss, keys, n);
+    t1 = now_sec();
+    printf("sharded search (%d): %8.1f ns/op (%d found)\n", nshards, (t1 - t0) * 1e9 / n, found);
+    sharded_destroy(&ss);
+    free(keys);
+}
+
+/* Interactive driver for the sharded set */
+void sharded_menu(void) {
+    struct ShardedSet ss;
+    int nshards = 4, choice, key;
+    sharded_init(&ss, nshards, 0, 1000);
+
+    while (1) {
+        printf("\nSharded set (%d shards, %d keys):\n", ss.nshards, sharded_size(&ss));
+        printf("1. Recreate with N shards over [lo, hi]\n");
+        printf("2. Insert key\n");
+        printf("3. Delete key\n");
+        printf("4. Search key\n");
+        printf("5. Range query [lo, hi]\n");
+        printf("6. Predecessor & successor\n");
+        printf("7. Bulk insert n random keys in [lo, hi]\n");
+        printf("8. Rebalance shard boundaries now (also automatic when skewed)\n");
+        printf("9. Shard statistics\n");
+        printf("10. Benchmark (single tree vs shards)\n");
+        printf("11. Back\n");
+        printf("Choice: ");
+        if (scanf("%d", &choice) != 1) {
+            int c;
+            while ((c = getchar()) != '\n' && c != EOF) {}
+            continue;
+        }
+
+        if (choice == 1) {
+            int n, lo, hi;
+            printf("Enter N, lo and hi: ");
+            if (scanf("%d %d %d", &n, &lo, &hi) == 3 && n > 0 && lo <= hi) {
+                sharded_destroy(&ss);
+                sharded_init(&ss, n, lo, hi);
+                if (ss.nshards != n) printf("Capped at %d shards\n", ss.nshards);
+            }
+        } else if (choice == 2) {
+            printf("Enter key to insert: ");
+            if (scanf("%d", &key) == 1) printf(sharded_insert(&ss, key) ? "Inserted\n" : "Already present\n");
+        } else if (choice == 3) {
+            printf("Enter key to delete: ");
+            if (scanf("%d", &key) == 1) printf(sharded_delete(&ss, key) ? "Deleted\n" : "Not found\n");
+        } else if (choice == 4) {
+            printf("Enter key to search: ");
+            if (scanf("%d", &key) == 1) printf(sharded_contains(&ss, key) ? "Found\n" : "Not found\n");
+        } else if (choice == 5) {
+            int lo, hi;
+            printf("Enter lo and hi: ");
+            if (scanf("%d %d", &lo, &hi) == 2) {
+                struct IntVec out = {NULL, 0, 0};
+                sharded_range(&ss, lo, hi, &out);
+                for (int i = 0; i < out.len; ++i) printf("%d ", out.items[i]);
+                printf("\n(%d keys)\n", out.len);
+                free(out.items);
+            }
+        } else if (choice == 6) {
+            printf("Enter key to find pred & succ: ");
+            if (scanf("%d", &key) == 1) {
+                int v;
+                if (sharded_pred(&ss, key, &v)) printf("Predecessor: %d\n", v); else printf("No predecessor\n");
+                if (sharded_succ(&ss, key, &v)) printf("Successor: %d\n", v); else printf("No successor\n");
+            }
+        } else if (choice == 7) {
+            int n, lo, hi;
+            printf("Enter n, lo and hi: ");
+            if (scanf("%d %d %d", &n, &lo, &hi) == 3 && n > 0 && lo <= hi) {
+                int *keys = (int*)malloc(sizeof(int) * (size_t)n);
+                if (!keys) { perror("malloc"); exit(1); }
+                for (int i = 0; i < n; ++i)
+                    keys[i] = (int)(lo + (long long)rand() % ((long long)hi - lo + 1));
+                printf("Inserted %d new keys\n", sharded_insert_batch(&ss, keys, n));
+                free(keys);
+            }
+        } else if (choice == 8) {
+            sharded_rebalance(&ss);
+            sharded_report(&ss);
+        } else if (choice == 9) {
+            sharded_report(&ss);
+        } else if (choice == 10) {
+            int n, shards;
+            printf("Enter number of keys and shards: ");
+            if (scanf("%d %d", &n, &shards) == 2 && n > 0 && shards > 0) bench_sharded(n, shards);
+        } else if (choice == 11) {
+            break;
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+    sharded_destroy(&ss);
+}
+
+/* ---------- Shape and access report ---------- */
+struct ShapeStats {
+    long long nodes;
+    long long leaves;
+    long long single_child; /* nodes with exactly one child: chain links */
+    long long depth_sum;    /* sum of node depths, root at depth 1 */
+    long long left_nodes, right_nodes; /* sizes of the root's subtrees */
+    int height;
+};
+
+static long long shape_walk(struct Node *n, int depth, struct ShapeStats *s) {
+    if (!n) return 0;
+    s->nodes++;
+    s->depth_sum += depth;
+    if (depth > s->height) s->height = depth;
+    if (!n->left && !n->right) s->leaves++;
+    else if (!n->left || !n->right) s->single_child++;
+    return 1 + shape_walk(n->left, depth + 1, s) + shape_walk(n->right, depth + 1, s);
+}
+
+void tree_shape(struct Node *root, struct ShapeStats *s) {
+    memset(s, 0, sizeof(*s));
+    if (!root) return;
+    s->nodes = s->depth_sum = 1;
+    s->height = 1;
+    if (!root->left && !root->right) s->leaves = 1;
+    else if (!root->left || !root->right) s->single_child = 1;
+    s->left_nodes = shape_walk(root->left, 2, s);
+    s->right_nodes = shape_walk(root->right, 2, s);
+}
+
+/* log2 without libm: integer part from the bit length, fraction by squaring */
+static double log2_d(double x) {
+    double r = 0.0;
+    if (x <= 0) return 0.0;
+    while (x >= 2.0) { x /= 2.0; r += 1.0; }
+    while (x < 1.0) { x *= 2.0; r -= 1.0; }
+    double bit = 0.5;
+    for (int i = 0; i < 30; ++i) {
+        x *= x;
+        if (x >= 2.0) { x /= 2.0; r += bit; }
+        bit /= 2.0;
+    }
+    return r;
+}
+
+/* Print height vs. the optimum, average depth and skew; as JSON if json != 0 */
+void shape_report(FILE *out, struct Node *root, int json) {
+    struct ShapeStats s;
+    tree_shape(root, &s);
+    double lg = log2_d((double)s.nodes + 1.0);
+    int optimal = s.nodes ? (int)lg + (lg > (int)lg) : 0; /* ceil(log2(n+1)) */
+    double avg_depth = s.nodes ? (double)s.depth_sum / s.nodes : 0.0;
+    double skew = s.nodes > 1 ? (double)(s.left_nodes - s.right_nodes) / (s.nodes - 1) : 0.0;
+    double chain = s.nodes ? (double)s.single_child / s.nodes : 0.0;
+
+    if (json) {
+        fprintf(out, "{\"nodes\": %lld, \"leaves\": %lld, \"height\": %d, \"log2_n\": %.3f, "
+                "\"optimal_height\": %d, \"height_ratio\": %.3f, \"avg_depth\": %.3f, "
+                "\"root_skew\": %.3f, \"single_child_ratio\": %.3f",
+                s.nodes, s.leaves, s.height, s.nodes ? log2_d((double)s.nodes) : 0.0,
+                optimal, optimal ? (double)s.height / optimal : 0.0, avg_depth, skew, chain);
+    } else {
+        fprintf(out, "Nodes: %lld  Leaves: %lld\n", s.nodes, s.leaves);
+        fprintf(out, "Height: %d  (optimal %d, log2(n) = %.2f, ratio %.2f)\n", s.height, optimal,
+                s.nodes ? log2_d((double)s.nodes) : 0.0, optimal ? (double)s.height / optimal : 0.0);
+        fprintf(out, "Average depth: %.2f\n", avg_depth);
+        fprintf(out, "Root skew (left-right)/n: %+.3f  Single-child nodes: %.1f%%\n", skew, chain * 100.0);
+    }
+
+#ifdef BST_STATS
+    const struct BstStats *c = &bst_stats;
+    unsigned long long ops = c->searches + c->inserts + c->deletes;
+    if (json) {
+        fprintf(out, ", \"counters\": {\"searches\": %llu, \"inserts\": %llu, \"deletes\": %llu, "
+                "\"cmp_per_search\": %.3f, \"cmp_per_insert\": %.3f, \"cmp_per_delete\": %.3f, "
+                "\"allocs\": %llu, \"frees\": %llu, \"rebuilds\": %llu, \"depth_hist\": [",
+                c->searches, c->inserts, c->deletes,
+                c->searches ? (double)c->cmp_search / c->searches : 0.0,
+                c->inserts ? (double)c->cmp_insert / c->inserts : 0.0,
+                c->deletes ? (double)c->cmp_delete / c->deletes : 0.0,
+                c->allocs, c->frees, c->rebuilds);
+        for (int i = 0; i < DEPTH_BUCKETS; ++i)
+            fprintf(out, "%s%llu", i ? ", " : "", c->depth_hist[i]);
+        fprintf(out, "]}");
+    } else {
+        fprintf(out, "Ops: %llu searches, %llu inserts, %llu deletes\n", c->searches, c->inserts, c->deletes);
+        fprintf(out, "Comparisons/op: search %.2f, insert %.2f, delete %.2f\n",
+                c->searches ? (double)c->cmp_search / c->searches : 0.0,
+                c->inserts ? (double)c->cmp_insert / c->inserts : 0.0,
+                c->deletes ? (double)c->cmp_delete / c->deletes : 0.0);
+        fprintf(out, "Node allocs: %llu  frees: %llu  subtree rebuilds: %llu\n",
+                c->allocs, c->frees, c->rebuilds);
+        fprintf(out, "Path length histogram (%llu ops):\n", ops);
+        for (int i = 0; i < DEPTH_BUCKETS; ++i)
+            if (c->depth_hist[i])
+                fprintf(out, "  %2d%s: %llu\n", i, i == DEPTH_BUCKETS - 1 ? "+" : " ", c->depth_hist[i]);
+    }
+#else
+    if (!json) fprintf(out, "(access counters not compiled in; rebuild with -DBST_STATS)\n");
+#endif
+    if (json) fprintf(out, "}\n");
+}
+
+/* ---------- Epoch-based reclamation ----------
+ * Lets deletes run while readers traverse the tree without locks. Readers
+ * bracket each traversal with ebr_enter/ebr_exit; writers never free a
+ * removed node directly but ebr_retire it. A node retired in epoch e is
+ * handed back to the node allocator only once the global epoch reaches
+ * e + 2, which can only happen after every reader active during e has
+ * left, so no reader can still hold a pointer to it.
+ *
+ * Retire and collect free through a NodeArena, which is single-threaded:
+ * callers must serialise them (ConcTree does so with its write lock).
+ */
+#define EBR_MAX_THREADS 64
+
+struct EbrThread {
+    atomic_uint local_epoch;
+    atomic_int active;
+    struct NodeVec limbo[3];    /* retired nodes, bucketed by epoch % 3 */
+    unsigned limbo_epoch[3];
+};
+
+struct Ebr {
+    atomic_uint global_epoch;
+    atomic_int nthreads;
+    struct EbrThread threads[EBR_MAX_THREADS];
+    struct NodeArena *arena;    /* NULL: nodes came from malloc */
+    unsigned long retired, freed;
+};
+
+void ebr_init(struct Ebr *e, struct NodeArena *arena) {
+    memset(e, 0, sizeof(*e));
+    atomic_init(&e->global_epoch, 0);
+    atomic_init(&e->nthreads, 0);
+    e->arena = arena;
+}
+
+/* Claim a thread slot; returns its id */
+int ebr_register(struct Ebr *e) {
+    int id = atomic_fetch_add(&e->nthreads, 1);
+    if (id >= EBR_MAX_THREADS) { fprintf(stderr, "ebr: too many threads\n"); exit(1); }
+    return id;
+}
+
+void ebr_enter(struct Ebr *e, int tid) {
+    struct EbrThread *t = &e->threads[tid];
+    atomic_store(&t->active, 1);
+    atomic_store(&t->local_epoch, atomic_load(&e->global_epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void ebr_exit(struct Ebr *e, int tid) {
+    atomic_store_explicit(&e->threads[tid].active, 0, memory_order_release);
+}
+
+/* Advance the global epoch if every active thread has observed it */
+static void ebr_try_advance(struct Ebr *e) {
+    unsigned g = atomic_load(&e->global_epoch);
+    int n = atomic_load(&e->nthreads);
+    for (int i = 0; i < n; ++i) {
+        struct EbrThread *t = &e->threads[i];
+        if (atomic_load(&t->active) && atomic_load(&t->local_epoch) != g) return;
+    }
+    atomic_compare_exchange_strong(&e->global_epoch, &g, g + 1);
+}
+
+static void ebr_free_bucket(struct Ebr *e, struct NodeVec *v) {
+    for (int i = 0; i < v->len; ++i) node_free(e->arena, v->items[i]);
+    e->freed += (unsigned long)v->len;
+    v->len = 0;
+}
+
+/* Free every bucket of thread tid whose grace period has passed */
+void ebr_collect(struct Ebr *e, int tid) {
+    struct EbrThread *t = &e->threads[tid];
+    ebr_try_advance(e);
+    unsigned g = atomic_load(&e->global_epoch);
+    for (int b = 0; b < 3; ++b)
+        if (t->limbo[b].len && g - t->limbo_epoch[b] >= 2) ebr_free_bucket(e, &t->limbo[b]);
+}
+
+/* Defer freeing n, already unlinked from the tree, until no reader can see it */
+void ebr_retire(struct Ebr *e, int tid, struct Node *n) {
+    struct EbrThread *t = &e->threads[tid];
+    unsigned g = atomic_load(&e->global_epoch);
+    struct NodeVec *v = &t->limbo[g % 3];
+    if (v->len && t->limbo_epoch[g % 3] != g) ebr_free_bucket(e, v); /* from epoch <= g-3 */
+    t->limbo_epoch[g % 3] = g;
+    nodevec_push(v, n);
+    e->retired++;
+}
+
+/* Free everything still in limbo; only valid once all readers are gone */
+void ebr_destroy(struct Ebr *e) {
+    int n = atomic_load(&e->nthreads);
+    for (int i = 0; i < n; ++i)
+        for (int b = 0; b < 3; ++b) {
+            ebr_free_bucket(e, &e->threads[i].limbo[b]);
+            free(e->threads[i].limbo[b].items);
+        }
+}
+
+/* Tree with lock-free readers and writers serialised by write_lock. Node
+   keys never change after publication: every structural change is a single
+   release store of a fully built replacement, and the two-child delete
+   path-copies down to the successor instead of moving its key in place, so
+   a concurrent reader sees either the old or the new tree. */
+struct ConcTree {
+    struct Node *root;
+    pthread_mutex_t write_lock;
+    struct NodeArena arena;
+    struct Ebr ebr;
+};
+
+#define LOAD_PTR(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define PUBLISH_PTR(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void ct_init(struct ConcTree *ct) {
+    ct->root = NULL;
+    pthread_mutex_init(&ct->write_lock, NULL);
+    arena_init(&ct->arena);
+    ebr_init(&ct->ebr, &ct->arena);
+}
+
+void ct_destroy(struct ConcTree *ct) {
+    ebr_destroy(&ct->ebr);
+    arena_destroy(&ct->arena);
+    pthread_mutex_destroy(&ct->write_lock);
+    ct->root = NULL;
+}
+
+int ct_contains(struct ConcTree *ct, int tid, int key) {
+    ebr_enter(&ct->ebr, tid);
+    struct Node *cur = LOAD_PTR(ct->root);
+    while (cur && cur->key != key)
+        cur = key < cur->key ? LOAD_PTR(cur->left) : LOAD_PTR(cur->right);
+    ebr_exit(&ct->ebr, tid);
+    return cur != NULL;
+}
+
+int ct_insert(struct ConcTree *ct, int key) {
+    pthread_mutex_lock(&ct->write_lock);
+    struct Node **link = &ct->root;
+    while (*link && (*link)->key != key)
+        link = key < (*link)->key ? &(*link)->left : &(*link)->right;
+    int added = *link == NULL;
+    if (added) PUBLISH_PTR(*link, arena_alloc(&ct->arena, key));
+    pthread_mutex_unlock(&ct->write_lock);
+    return added;
+}
+
+int ct_delete(struct ConcTree *ct, int tid, int key) {
+    pthread_mutex_lock(&ct->write_lock);
+    struct Node **link = &ct->root;
+    while (*link && (*link)->key != key)
+        link = key < (*link)->key ? &(*link)->left : &(*link)->right;
+    struct Node *n = *link;
+    if (n) {
+        if (!n->left || !n->right) {
+            PUBLISH_PTR(*link, n->left ? n->left : n->right);
+        } else {
+            /* Copy the path n->right .. successor, dropping the successor */
+            struct Node *newright = NULL, **tail = &newright, *p = n->right;
+            while (p->left) {
+                struct Node *c = arena_alloc(&ct->arena, p->key);
+                c->right = p->right;
+                *tail = c;
+                tail = &c->left;
+                p = p->left;
+            }
+            *tail = p->right;
+            struct Node *repl = arena_alloc(&ct->arena, p->key);
+            repl->left = n->left;
+            repl->right = newright;
+            PUBLISH_PTR(*link, repl);
+            for (struct Node *q = n->right; q != p; q = q->left) ebr_retire(&ct->ebr, tid, q);
+            ebr_retire(&ct->ebr, tid, p);
+        }
+        ebr_retire(&ct->ebr, tid, n);
+    }
+    ebr_collect(&ct->ebr, tid);
+    pthread_mutex_unlock(&ct->write_lock);
+    return n != NULL;
+}
+
+/* Stress test: even keys are inserted up front and never deleted, so
+   readers must always find them; writers churn odd keys. Any premature
+   free shows up as a wrong answer, an ASan/TSan report or a crash. */
+#define STRESS_KEYS 4096
+
+struct StressArgs {
+    struct ConcTree *ct;
+    atomic_int *stop;
+    int writer;
+    unsigned seed;
+    unsigned long ops;
+    unsigned long errors;
+};
+
+static void* ebr_stress_thread(void *arg) {
+    struct StressArgs *a = (struct StressArgs*)arg;
+    int tid = ebr_register(&a->ct->ebr);
+    unsigned x = a->seed;
+    while (!atomic_load_explicit(a->stop, memory_order_relaxed)) {
+        x = x * 1103515245u + 12345u;
+        int key = (int)((x >> 8) % STRESS_KEYS);
+        if (a->writer) {
+            key |= 1;
+            if (x >> 31) ct_insert(a->ct, key);
+            else ct_delete(a->ct, tid, key);
+        } else {
+            int found = ct_contains(a->ct, tid, key);
+            if (!(key & 1) && !found) a->errors++;
+        }
+        a->ops++;
+    }
+    return NULL;
+}
+
+static int ct_check(struct Node *n, long long lo, long long hi, int *count) {
+    if (!n) return 1;
+    if (n->key <= lo || n->key >= hi) return 0;
+    (*count)++;
+    return ct_check(n->left, lo, n->key, count) && ct_check(n->right, n->key, hi, count);
+}
+
+int ebr_stress(int readers, int writers, double seconds) {
+    struct ConcTree ct;
+    atomic_int stop;
+    int nthreads = readers + writers;
+    if (readers < 0 || writers < 0 || nthreads < 1 || nthreads > EBR_MAX_THREADS) {
+        fprintf(stderr, "need 1..%d threads\n", EBR_MAX_THREADS);
+        return 1;
+    }
+    ct_init(&ct);
+    atomic_init(&stop, 0);
+    /* Insert the stable keys in a scrambled order so the tree is bushy */
+    for (int i = 0; i < STRESS_KEYS / 2; ++i) ct_insert(&ct, (int)((i * 2654435761u) % (STRESS_KEYS / 2)) * 2);
+
+    pthread_t th[EBR_MAX_THREADS];
+    struct StressArgs args[EBR_MAX_THREADS];
+    for (int i = 0; i < nthreads; ++i) {
+        args[i].ct = &ct;
+        args[i].stop = &stop;
+        args[i].writer = i < writers;
+        args[i].seed = 0x9e3779b9u * (unsigned)(i + 1);
+        args[i].ops = args[i].errors = 0;
+        pthread_create(&th[i], NULL, ebr_stress_thread, &args[i]);
+    }
+    double end = now_sec() + seconds;
+    while (now_sec() < end) {
+        struct timespec ts = {0, 10 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    atomic_store(&stop, 1);
+
+    unsigned long rops = 0, wops = 0, errors = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(th[i], NULL);
+        if (args[i].writer) wops += args[i].ops; else rops += args[i].ops;
+        errors += args[i].errors;
+    }
+    int count = 0, ordered = ct_check(ct.root, LLONG_MIN, LLONG_MAX, &count);
+    printf("reads %lu, writes %lu, retired %lu, freed %lu before shutdown, epoch %u\n",
+           rops, wops, ct.ebr.retired, ct.ebr.freed, atomic_load(&ct.ebr.global_epoch));
+    printf("tree: %d keys, BST order %s, stable keys missed %lu\n",
+           count, ordered ? "ok" : "BROKEN", errors);
+    ct_destroy(&ct);
+    int ok = ordered && errors == 0;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+/* ---------- Succinct binary snapshots ----------
+ * Layout (host byte order):
+ *   "BSTS", u32 version, u64 nodes, u64 key_bytes
+ *   shape: 2 bits per node in preorder (bit 0 = has left, bit 1 = has right)
+ *   keys:  preorder, first key then successive differences, each zigzag
+ *          varint encoded (1 byte for neighbours closer than 64)
+ * Null children cost nothing beyond their shape bit, against "# " per null
+ * in the text format. Both directions (and the error path's free_tree)
+ * avoid recursion, so degenerate (chain) trees of any depth are fine.
+ */
+#define SNAP_MAGIC "BSTS"
+#define SNAP_VERSION 1u
+
+static size_t put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (unsigned char)(v | 0x80); v >>= 7; }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/* Write root as a succinct snapshot; 0 on success, -1 on write error */
+int save_tree_succinct(FILE *fp, struct Node *root) {
+    struct NodeVec stack = {NULL, 0, 0};
+    uint64_t n = 0;
+    /* counting pass over the same stack walk; count_nodes recurses */
+    if (root) nodevec_push(&stack, root);
+    while (stack.len) {
+        struct Node *cur = stack.items[--stack.len];
+        n++;
+        if (cur->right) nodevec_push(&stack, cur->right);
+        if (cur->left) nodevec_push(&stack, cur->left);
+    }
+    unsigned char *shape = (unsigned char*)calloc(n / 4 + 1, 1);
+    unsigned char *keys = (unsigned char*)malloc(n * 10 + 1);
+    if (!shape || !keys) { perror("malloc"); exit(1); }
+
+    uint64_t i = 0, key_bytes = 0;
+    int64_t prev = 0;
+    if (root) nodevec_push(&stack, root);
+    while (stack.len) {
+        struct Node *cur = stack.items[--stack.len];
+        unsigned bits = (cur->left ? 1u : 0u) | (cur->right ? 2u : 0u);
+        shape[i / 4] |= (unsigned char)(bits << ((i % 4) * 2));
+        key_bytes += put_varint(keys + key_bytes, zigzag((int64_t)cur->key - prev));
+        prev = cur->key;
+        i++;
+        if (cur->right) nodevec_push(&stack, cur->right);
+        if (cur->left) nodevec_push(&stack, cur->left);
+    }
+    free(stack.items);
+
+    uint32_t version = SNAP_VERSION;
+    int ok = fwrite(SNAP_MAGIC, 1, 4, fp) == 4 &&
+             fwrite(&version, sizeof(version), 1, fp) == 1 &&
+             fwrite(&n, sizeof(n), 1, fp) == 1 &&
+             fwrite(&key_bytes, sizeof(key_bytes), 1, fp) == 1 &&
+             fwrite(shape, 1, (size_t)((n + 3) / 4), fp) == (size_t)((n + 3) / 4) &&
+             fwrite(keys, 1, (size_t)key_bytes, fp) == (size_t)key_bytes;
+    free(shape);
+    free(keys);
+    return ok ? 0 : -1;
+}
+
+/* Read a succinct snapshot into *out. Returns 0 on success, -1 for a bad
+   header, -2 for truncated data, -3 for an inconsistent shape, a key
+   outside the int range or bytes left over after the last key. */
+int load_tree_succinct(FILE *fp, struct Node **out) {
+    char magic[4];
+    uint32_t version;
+    uint64_t n, key_bytes;
+    *out = NULL;
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, SNAP_MAGIC, 4) != 0 ||
+        fread(&version, sizeof(version), 1, fp) != 1 || version != SNAP_VERSION ||
+        fread(&n, sizeof(n), 1, fp) != 1 || fread(&key_bytes, sizeof(key_bytes), 1, fp) != 1 ||
+        n > (uint64_t)INT_MAX || key_bytes > n * 10)
+        return -1;
+
+    size_t shape_len = (size_t)((n + 3) / 4);
+    unsigned char *buf = (unsigned char*)malloc(shape_len + (size_t)key_bytes + 1);
+    if (!buf) { perror("malloc"); exit(1); }
+    if (fread(buf, 1, shape_len + (size_t)key_bytes, fp) != shape_len + (size_t)key_bytes) {
+        free(buf);
+        return -2;
+    }
+    const unsigned char *shape = buf, *kp = buf + shape_len, *kend = kp + key_bytes;
+
+    /* Slots still waiting for a child, filled in preorder */
+    struct Node ***slots = (struct Node***)malloc(sizeof(struct Node**) * (size_t)(n + 1));
+    if (!slots) { perror("malloc"); exit(1); }
+    int top = 0, err = 0;
+    int64_t prev = 0;
+    struct Node *root = NULL;
+    if (n > 0) slots[top++] = &root; /* an empty tree has no root slot */
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t v = 0;
+        int shift = 0;
+        while (kp < kend && (*kp & 0x80) && shift < 63) { v |= (uint64_t)(*kp++ & 0x7f) << shift; shift += 7; }
+        if (kp == kend || top == 0) { err = kp == kend ? -2 : -3; break; }
+        v |= (uint64_t)*kp++ << shift;
+        /* neighbouring ints differ by less than 2^32; checking that first
+           keeps the int64 sum from overflowing */
+        int64_t delta = unzigzag(v);
+        if (delta > (int64_t)UINT32_MAX || delta < -(int64_t)UINT32_MAX ||
+            prev + delta < INT_MIN || prev + delta > INT_MAX) { err = -3; break; }
+        prev += delta;
+
+        struct Node *node = newNode((int)prev);
+        *slots[--top] = node;
+        unsigned bits = (shape[i / 4] >> ((i % 4) * 2)) & 3u;
+        if (bits & 2u) slots[top++] = &node->right;
+        if (bits & 1u) slots[top++] = &node->left;
+    }
+    if (!err && (top != 0 || kp != kend)) err = -3;
+    free(slots);
+    free(buf);
+    if (err) { free_tree(root); return err; }
+    *out = root;
+    return 0;
+}
+
+/* Size and speed of the text and succinct formats on n random keys */
+void bench_snapshots(int n) {
+    struct Node *root = NULL, *back = NULL;
+    for (int i = 0; i < n; ++i) root = insert_iterative(root, rand());
+    FILE *fp = tmpfile();
+    if (!fp) { perror("tmpfile"); return; }
+    double t0, t1;
+    long size;
+
+    t0 = now_sec();
+    save_tree_preorder(fp, root);
+    fflush(fp);
+    t1 = now_sec();
+    size = ftell(fp);
+    printf("text preorder:  %9ld bytes  save %7.2f ms", size, (t1 - t0) * 1e3);
+    rewind(fp);
+    t0 = now_sec();
+    back = load_tree_preorder(fp);
+    t1 = now_sec();
+    printf("  load %7.2f ms\n", (t1 - t0) * 1e3);
+    free_tree(back);
+    fclose(fp);
+
+    fp = tmpfile();
+    if (!fp) { perror("tmpfile"); free_tree(root); return; }
+    t0 = now_sec();
+    save_tree_succinct(fp, root);
+    fflush(fp);
+    t1 = now_sec();
+    size = ftell(fp);
+    printf("succinct:       %9ld bytes  save %7.2f ms", size, (t1 - t0) * 1e3);
+    rewind(fp);
+    t0 = now_sec();
+    int err = load_tree_succinct(fp, &back);
+    t1 = now_sec();
+    printf("  load %7.2f ms (%s)\n", (t1 - t0) * 1e3, err ? "FAILED" : "ok");
+    free_tree(back);
+    fclose(fp);
+    free_tree(root);
+}
+
+/* Nearest-neighbour queries: predecessor()+successor() vs neighbors()
+   vs neighbors_batch() on random probes */
+void bench_neighbors(int n) {
+    struct Node *root = NULL;
+    struct PerfCounters pc;
+    int *probes = (int*)malloc(sizeof(int) * (size_t)n);
+    struct Neighbors *out = (struct Neighbors*)malloc(sizeof(struct Neighbors) * (size_t)n);
+    if (!probes || !out) { perror("malloc"); exit(1); }
+    for (int i = 0; i < n; ++i) {
+        root = insert_iterative(root, rand());
+        probes[i] = rand();
+    }
+    perf_open(&pc);
+    long sum = 0;
+    double t0, t1;
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) {
+        struct Node *p = predecessor(root, probes[i]), *q = successor(root, probes[i]);
+        sum += (p ? p->key : 0) + (q ? q->key : 0);
+    }
+    t1 = now_sec(); perf_stop(&pc);
+    printf("pred + succ:     %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "pred + succ", n);
+
+    perf_start(&pc); t0 = now_sec();
+    for (int i = 0; i < n; ++i) {
+        struct Neighbors nb = neighbors(root, probes[i]);
+        sum -= (nb.pred ? nb.pred->key : 0) + (nb.succ ? nb.succ->key : 0);
+    }
+    t1 = now_sec(); perf_stop(&pc);
+    printf("neighbors:       %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "neighbors", n);
+
+    perf_start(&pc); t0 = now_sec();
+    neighbors_batch(root, probes, n, out);
+    t1 = now_sec(); perf_stop(&pc);
+    for (int i = 0; i < n; ++i)
+        sum += (out[i].pred ? out[i].pred->key : 0) + (out[i].succ ? out[i].succ->key : 0);
+    printf("neighbors_batch: %8.1f ns/op\n", (t1 - t0) * 1e9 / n);
+    perf_report(&pc, "neighbors_batch", n);
+
+    printf("n=%d height=%d (checksum %ld)\n", n, height(root), sum);
+    perf_close(&pc);
+    free_tree(root);
+    free(probes);
+    free(out);
+}
+
+/* ---------- Socket server mode ----------
+ * Wire protocol, host byte order (clients are on the same machine):
+ *   request:  u8 op, i32 key [, i32 hi for BSTP_RANGE]
+ *   response: u8 status, i32 value
+ *             BSTP_RANGE: u8 status, i32 count, count x i32 keys
+ * value is the found key for search/pred/succ, the tree size for
+ * BSTP_COUNT, and 0 otherwise. Clients may pipeline any number of
+ * requests; responses come back in request order. Each epoll wakeup reads
+ * what a connection has sent, executing the complete requests after every
+ * read, and answers them with as few writes as possible. Once more than
+ * CONN_OUT_HIGH bytes of replies are waiting, the server stops reading
+ * from that connection until the client has taken them, so a client that
+ * pipelines without reading cannot grow the server's memory. A client
+ * that half-closes still receives all its replies.
+ */
+#define CONN_OUT_HIGH (1 << 20)
+#define CONN_READ_CHUNK 65536
+enum { BSTP_INSERT = 1, BSTP_DELETE, BSTP_SEARCH, BSTP_PRED, BSTP_SUCC, BSTP_RANGE, BSTP_COUNT };
+enum { BSTP_OK = 0, BSTP_NOTFOUND = 1, BSTP_BADOP = 2 };
+
+#ifdef __linux__
+struct ByteBuf {
+    unsigned char *data;
+    size_t len;
+    size_t off;  /* consumed prefix */
+    size_t cap;
+};
+
+static void bytebuf_reserve(struct ByteBuf *b, size_t extra) {
+    if (b->off && b->off == b->len) b->off = b->len = 0;
+    if (b->len + extra <= b->cap) return;
+    if (b->off) { /* compact before growing */
+        memmove(b->data, b->data + b->off, b->len - b->off);
+        b->len -= b->off;
+        b->off = 0;
+        if (b->len + extra <= b->cap) return;
+    }
+    size_t ncap = b->cap ? b->cap : 4096;
+    while (ncap < b->len + extra) ncap *= 2;
+    unsigned char *nd = (unsigned char*)realloc(b->data, ncap);
+    if (!nd) { perror("realloc"); exit(1); }
+    b->data = nd;
+    b->cap = ncap;
+}
+
+static void bytebuf_put(struct ByteBuf *b, const void *p, size_t n) {
+    bytebuf_reserve(b, n);
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+static void put_reply(struct ByteBuf *out, unsigned char status, int value) {
+    bytebuf_put(out, &status, 1);
+    bytebuf_put(out, &value, 4);
+}
+
+struct Conn {
+    int fd;
+    int eof;            /* peer has shut down its write side */
+    uint32_t events;    /* epoll interest currently registered */
+    struct ByteBuf in, out;
+};
+
+static size_t conn_pending(const struct Conn *c) {
+    return c->out.len - c->out.off;
+}
+
+struct ServerState {
+    struct Node *root;
+    int size;
+    unsigned long long ops;
+};
+
+static volatile sig_atomic_t server_stop;
+
+static void server_on_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+/* Execute every complete request in c->in, appending replies to c->out */
+static void server_run_batch(struct ServerState *st, struct Conn *c) {
+    struct ByteBuf *in = &c->in;
+    while (in->len - in->off >= 5) {
+        const unsigned char *p = in->data + in->off;
+        unsigned char op = p[0];
+        int key, hi, added;
+        memcpy(&key, p + 1, 4);
+        if (op == BSTP_RANGE) {
+            if (in->len - in->off < 9) break;
+            memcpy(&hi, p + 5, 4);
+            struct IntVec keys = {NULL, 0, 0};
+            if (key <= hi) range_collect(st->root, key, hi, &keys);
+            put_reply(&c->out, BSTP_OK, keys.len);
+            bytebuf_put(&c->out, keys.items, (size_t)keys.len * 4);
+            free(keys.items);
+            in->off += 9;
+            st->ops++;
+            continue;
+        }
+        in->off += 5;
+        st->ops++;
+        struct Node *n;
+        switch (op) {
+        case BSTP_INSERT:
+            st->root = insert_arena(NULL, st->root, key, &added);
+            st->size += added;
+            put_reply(&c->out, added ? BSTP_OK : BSTP_NOTFOUND, 0);
+            break;
+        case BSTP_DELETE:
+            if (search_recursive(st->root, key)) {
+                st->root = deleteNode(st->root, key);
+                st->size--;
+                put_reply(&c->out, BSTP_OK, 0);
+            } else {
+                put_reply(&c->out, BSTP_NOTFOUND, 0);
+            }
+            break;
+        case BSTP_SEARCH:
+        case BSTP_PRED:
+        case BSTP_SUCC:
+            n = op == BSTP_SEARCH ? search_recursive(st->root, key)
+              : op == BSTP_PRED ? predecessor(st->root, key) : successor(st->root, key);
+            put_reply(&c->out, n ? BSTP_OK : BSTP_NOTFOUND, n ? n->key : 0);
+            break;
+        case BSTP_COUNT:
+            put_reply(&c->out, BSTP_OK, st->size);
+            break;
+        default:
+            put_reply(&c->out, BSTP_BADOP, 0);
+            break;
+        }
+    }
+}
+
+/* Write as much pending output as the socket takes; -1 on a dead peer */
+static int conn_flush(struct Conn *c) {
+    struct ByteBuf *out = &c->out;
+    while (out->off < out->len) {
+        ssize_t w = send(c->fd, out->data + out->off, out->len - out->off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        out->off += (size_t)w;
+    }
+    out->off = out->len = 0;
+    return 0;
+}
+
+static void conn_close(int ep, struct Conn *c) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+}
+
+/* Serve the tree on a Unix-domain socket until SIGINT/SIGTERM */
+int serve_unix(const char *path, const char *tree_file) {
+    struct ServerState st = {NULL, 0, 0};
+    if (tree_file) {
+        FILE *fp = fopen(tree_file, "r");
+        if (!fp) { perror(tree_file); return 1; }
+        st.root = load_tree_preorder(fp);
+        fclose(fp);
+        st.size = count_nodes(st.root);
+    }
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) { perror("socket"); return 1; }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) { fprintf(stderr, "socket path too long\n"); return 1; }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 128) < 0) {
+        perror("bind/listen");
+        close(lfd);
+        return 1;
+    }
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        perror("epoll_create1");
+        close(lfd);
+        return 1;
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL marks the listening socket */
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(ep);
+        close(lfd);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    printf("Serving %d keys on %s (Ctrl-C to stop)\n", st.size, path);
+    fflush(stdout);
+
+    struct epoll_event events[64];
+    while (!server_stop) {
+        int nev = epoll_wait(ep, events, 64, -1);
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nev; ++i) {
+            struct Conn *c = (struct Conn*)events[i].data.ptr;
+            if (!c) {
+                int fd;
+                while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    struct Conn *nc = (struct Conn*)calloc(1, sizeof(struct Conn));
+                    if (!nc) { perror("calloc"); exit(1); }
+                    nc->fd = fd;
+                    nc->events = EPOLLIN | EPOLLRDHUP;
+                    struct epoll_event cev = {0};
+                    cev.events = nc->events;
+                    cev.data.ptr = nc;
+                    if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &cev) < 0) {
+                        perror("epoll_ctl");
+                        close(fd);
+                        free(nc);
+                    }
+                }
+                continue;
+            }
+
+            /* EPOLLHUP: both directions are gone, nothing can be delivered */
+            int dead = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+            if (!dead && !c->eof && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                while (conn_pending(c) <= CONN_OUT_HIGH) {
+                    bytebuf_reserve(&c->in, CONN_READ_CHUNK);
+                    ssize_t r = recv(c->fd, c->in.data + c->in.len, CONN_READ_CHUNK, 0);
+                    if (r > 0) {
+                        c->in.len += (size_t)r;
+                        server_run_batch(&st, c);
+                        if (conn_pending(c) > CONN_OUT_HIGH && conn_flush(c) < 0) dead = 1;
+                        if (dead) break;
+                        continue;
+                    }
+                    if (r == 0) c->eof = 1; /* half-close: still owed its replies */
+                    else if (errno == EINTR) continue;
+                    else if (errno != EAGAIN && errno != EWOULDBLOCK) dead = 1;
+                    break;
+                }
+            }
+            if (!dead && conn_flush(c) < 0) dead = 1;
+            if (!dead && c->eof && conn_pending(c) == 0) dead = 1; /* all answered */
+            if (dead) { conn_close(ep, c); continue; }
+
+            /* read only while replies are below the high-water mark and the
+               peer may still send; wait for writability while any are queued */
+            uint32_t want = conn_pending(c) ? EPOLLOUT : 0;
+            if (!c->eof && conn_pending(c) <= CONN_OUT_HIGH) want |= EPOLLIN | EPOLLRDHUP;
+            if (want != c->events) {
+                struct epoll_event cev = {0};
+                cev.events = want;
+                cev.data.ptr = c;
+                if (epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &cev) < 0) {
+                    perror("epoll_ctl");
+                    conn_close(ep, c);
+                    continue;
+                }
+                c->events = want;
+            }
+        }
+    }
+
+    printf("\nServed %llu ops, %d keys remain\n", st.ops, st.size);
+    close(ep);
+    close(lfd);
+    unlink(path);
+    free_tree(st.root);
+    return 0;
+}
+
+/* Load generator: ops requests (half inserts, half searches of random keys
+   below 2^20), sent in pipelined bursts of depth requests */
+int client_bench(const char *path, long ops, int depth) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return 1;
+    }
+    unsigned char *req = (unsigned char*)malloc((size_t)depth * 5);
+    unsigned char *resp = (unsigned char*)malloc((size_t)depth * 5);
+    if (!req || !resp) { perror("malloc"); exit(1); }
+    long found = 0;
+
+    double t0 = now_sec();
+    for (long done = 0; done < ops; ) {
+        int burst = ops - done < depth ? (int)(ops - done) : depth;
+        for (int i = 0; i < burst; ++i) {
+            int key = rand() & 0xfffff;
+            req[i * 5] = ((done + i) & 1) ? BSTP_SEARCH : BSTP_INSERT;
+            memcpy(req + i * 5 + 1, &key, 4);
+        }
+        size_t want = (size_t)burst * 5, got = 0;
+        for (size_t sent = 0; sent < want; ) {
+            ssize_t w = send(fd, req + sent, want - sent, MSG_NOSIGNAL);
+            if (w < 0) { perror("send"); return 1; }
+            sent += (size_t)w;
+        }
+        while (got < want) {
+            ssize_t r = recv(fd, resp + got, want - got, 0);
+            if (r <= 0) { perror("recv"); return 1; }
+            got += (size_t)r;
+        }
+        for (int i = 0; i < burst; ++i)
+            found += ((done + i) & 1) && resp[i * 5] == BSTP_OK;
+        done += burst;
+    }
+    double t1 = now_sec();
+
+    printf("%ld ops, pipeline depth %d: %.0f ops/sec (%ld searches hit)\n",
+           ops, depth, ops / (t1 - t0), found);
+    free(req);
+    free(resp);
+    close(fd);
+    return 0;
+}
+#else
+int serve_unix(const char *path, const char *tree_file) {
+    (void)path; (void)tree_file;
+    fprintf(stderr, "Server mode needs Linux (epoll)\n");
+    return 1;
+}
+
+int client_bench(const char *path, long ops, int depth) {
+    (void)path; (void)ops; (void)depth;
+    fprintf(stderr, "Client mode needs Linux\n");
+    return 1;
+}
+#endif
+
+/* ---------- Differential fuzzing ----------
+ * Runs one random op stream against a bitmap reference model and the
+ * single-threaded tree variants (baseline, finger, indexed + Bloom, arena,
+ * persistent) plus the concurrent tree, comparing each answer, and
+ * periodically checks BST order and full contents of every variant. The
+ * range-sharded set would pay a thread handoff per op, so it is brought
+ * up to date with the reference in batches every 1024 ops and then
+ * queried (lookups, ranges, cross-shard pred/succ). It starts with all
+ * but one shard squeezed into [0, FUZZ_SHARD_SPAN) and is restarted that
+ * way every FUZZ_SHARD_RESTART syncs, so automatic rebalancing runs. The
+ * versioned tree, the server and the EBR stress test are not covered.
+ * The key space is kept small so trees stay a few hundred nodes deep and
+ * hot in cache, which keeps the run at millions of ops per second.
+ */
+#define FUZZ_KEYS 512
+#define FUZZ_SHARDS 4
+#define FUZZ_SHARD_SPAN 16
+#define FUZZ_SHARD_RESTART 16
+
+struct FuzzState {
+    unsigned char ref[FUZZ_KEYS];
+    int count;
+    struct Node *base;          /* insert_recursive/iterative + deleteNode */
+    struct Node *fing;          /* finger_insert/finger_search */
+    struct Finger finger;
+    struct Node *indexed;       /* indexed_* + Bloom filter */
+    struct HashIndex index;
+    struct BloomFilter bloom;
+    struct Node *arena_tree;    /* insert_arena/deleteNode_arena */
+    struct NodeArena arena;
+    struct PNode *version;      /* p_insert/p_delete */
+    struct PNode *pinned;       /* older version checked against ref_pinned */
+    unsigned char ref_pinned[FUZZ_KEYS];
+    struct ConcTree conc;
+    int conc_tid;
+    struct ShardedSet sharded;  /* synced to ref by fuzz_sync_sharded */
+    unsigned char ref_sharded[FUZZ_KEYS]; /* keys the sharded set holds */
+    int shard_syncs;
+    int shard_rebalances;       /* summed over restarts */
+};
+
+static uint64_t fuzz_next(uint64_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static int ref_neighbour(const unsigned char *ref, int key, int dir) {
+    for (int k = key + dir; k >= 0 && k < FUZZ_KEYS; k += dir)
+        if (ref[k]) return k;
+    return -1;
+}
+
+/* In-order walk comparing against the reference; -1 if order/content differ */
+static int fuzz_walk(struct Node *n, const unsigned char *ref, int *next) {
+    if (!n) return 0;
+    if (fuzz_walk(n->left, ref, next) < 0) return -1;
+    if (n->key < *next || n->key >= FUZZ_KEYS || !ref[n->key]) return -1;
+    for (int k = *next; k < n->key; ++k) if (ref[k]) return -1; /* skipped a key */
+    *next = n->key + 1;
+    return fuzz_walk(n->right, ref, next);
+}
+
+static int fuzz_walk_p(struct PNode *n, const unsigned char *ref, int *next) {
+    if (!n) return 0;
+    if (fuzz_walk_p(n->left, ref, next) < 0) return -1;
+    if (n->key < *next || n->key >= FUZZ_KEYS || !ref[n->key]) return -1;
+    for (int k = *next; k < n->key; ++k) if (ref[k]) return -1;
+    *next = n->key + 1;
+    return fuzz_walk_p(n->right, ref, next);
+}
+
+static int fuzz_same(struct Node *root, const unsigned char *ref) {
+    int next = 0;
+    if (fuzz_walk(root, ref, &next) < 0) return 0;
+    for (int k = next; k < FUZZ_KEYS; ++k) if (ref[k]) return 0;
+    return 1;
+}
+
+static int fuzz_same_p(struct PNode *root, const unsigned char *ref) {
+    int next = 0;
+    if (fuzz_walk_p(root, ref, &next) < 0) return 0;
+    for (int k = next; k < FUZZ_KEYS; ++k) if (ref[k]) return 0;
+    return 1;
+}
+
+static int fuzz_fail(long i, const char *what, int key) {
+    printf("MISMATCH at op %ld: %s (key %d)\n", i, what, key);
+    return 1;
+}
+
+/* Whole-structure comparison of every variant against the reference */
+static int fuzz_check_all(struct FuzzState *f, long i) {
+    if (!fuzz_same(f->base, f->ref)) return fuzz_fail(i, "baseline contents", -1);
+    if (!fuzz_same(f->fing, f->ref)) return fuzz_fail(i, "finger contents", -1);
+    if (!fuzz_same(f->indexed, f->ref)) return fuzz_fail(i, "indexed contents", -1);
+    if ((int)f->index.count != f->count) return fuzz_fail(i, "hash index size", -1);
+    if (!fuzz_same(f->arena_tree, f->ref)) return fuzz_fail(i, "arena contents", -1);
+    if (f->arena.live != f->count) return fuzz_fail(i, "arena live count", -1);
+    if (!fuzz_same_p(f->version, f->ref)) return fuzz_fail(i, "persistent contents", -1);
+    if (f->pinned && !fuzz_same_p(f->pinned, f->ref_pinned)) return fuzz_fail(i, "pinned version changed", -1);
+    if (!fuzz_same(f->conc.root, f->ref)) return fuzz_fail(i, "concurrent tree contents", -1);
+    return 0;
+}
+
+/* Expected keys of [lo, hi] in v, in order */
+static int fuzz_same_range(const struct IntVec *v, const unsigned char *ref, int lo, int hi) {
+    int j = 0;
+    for (int k = lo < 0 ? 0 : lo; k <= hi && k < FUZZ_KEYS; ++k) {
+        if (!ref[k]) continue;
+        if (j >= v->len || v->items[j] != k) return 0;
+        j++;
+    }
+    return j == v->len;
+}
+
+static void fuzz_restart_sharded(struct FuzzState *f) {
+    if (f->sharded.shards) {
+        f->shard_rebalances += atomic_load(&f->sharded.rebalances);
+        sharded_destroy(&f->sharded);
+    }
+    sharded_init(&f->sharded, FUZZ_SHARDS, 0, FUZZ_SHARD_SPAN);
+    memset(f->ref_sharded, 0, FUZZ_KEYS);
+}
+
+/* Apply the changes since the last sync to the sharded set as one delete
+   and one insert batch, then check it against the reference */
+static int fuzz_sync_sharded(struct FuzzState *f, long i, uint64_t r) {
+    int keys[FUZZ_KEYS], gone[FUZZ_KEYS], nadd = 0, ndel = 0;
+    struct IntVec v = {NULL, 0, 0};
+    if (++f->shard_syncs % FUZZ_SHARD_RESTART == 0) fuzz_restart_sharded(f);
+    for (int k = 0; k < FUZZ_KEYS; ++k) {
+        if (f->ref[k] && !f->ref_sharded[k]) keys[nadd++] = k;
+        else if (!f->ref[k] && f->ref_sharded[k]) gone[ndel++] = k;
+    }
+    if (ndel && sharded_delete(&f->sharded, gone[0]) != 1)
+        return fuzz_fail(i, "sharded_delete result", gone[0]);
+    if (sharded_delete_batch(&f->sharded, gone, ndel) != (ndel ? ndel - 1 : 0))
+        return fuzz_fail(i, "sharded_delete_batch removed", -1);
+    if (sharded_insert_batch(&f->sharded, keys, nadd) != nadd)
+        return fuzz_fail(i, "sharded_insert_batch added", -1);
+    if (nadd && sharded_insert_batch(&f->sharded, keys, nadd) != 0)
+        return fuzz_fail(i, "sharded_insert_batch duplicates", -1);
+    memcpy(f->ref_sharded, f->ref, FUZZ_KEYS);
+
+    for (int k = 0; k < FUZZ_KEYS; ++k) keys[k] = k;
+    if (sharded_size(&f->sharded) != f->count) return fuzz_fail(i, "sharded size", -1);
+    if (sharded_search_batch(&f->sharded, keys, FUZZ_KEYS) != f->count)
+        return fuzz_fail(i, "sharded_search_batch", -1);
+    sharded_range(&f->sharded, INT_MIN, INT_MAX, &v);
+    int ok = fuzz_same_range(&v, f->ref, 0, FUZZ_KEYS - 1);
+    int lo = (int)((r >> 16) % FUZZ_KEYS) - 8, hi = lo + (int)((r >> 32) % 128);
+    v.len = 0;
+    sharded_range(&f->sharded, lo, hi, &v);
+    ok = ok ? 1 + fuzz_same_range(&v, f->ref, lo, hi) : 0;
+    free(v.items);
+    if (ok != 2) return fuzz_fail(i, ok ? "sharded_range" : "sharded contents", lo);
+    for (int j = 0; j < 8; ++j) {
+        int k = j == 0 ? -1 : j == 1 ? FUZZ_KEYS : (int)((r >> (8 * j)) % FUZZ_KEYS), got;
+        int ep = ref_neighbour(f->ref, k, -1), es = ref_neighbour(f->ref, k, 1);
+        if ((sharded_pred(&f->sharded, k, &got) ? got : -1) != ep) return fuzz_fail(i, "sharded_pred", k);
+        if ((sharded_succ(&f->sharded, k, &got) ? got : -1) != es) return fuzz_fail(i, "sharded_succ", k);
+        if (k >= 0 && k < FUZZ_KEYS && sharded_contains(&f->sharded, k) != f->ref[k])
+            return fuzz_fail(i, "sharded_contains", k);
+    }
+    return 0;
+}
+
+/* Save with one format and load back, replacing *root */
+static int fuzz_roundtrip(struct Node **root, int succinct) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&buf, &len);
+    if (!fp) { perror("open_memstream"); exit(1); }
+    if (succinct) save_tree_succinct(fp, *root);
+    else save_tree_preorder(fp, *root);
+    fclose(fp);
+    fp = fmemopen(buf, len ? len : 1, "r");
+    if (!fp) { perror("fmemopen"); exit(1); }
+    struct Node *back = NULL;
+    int ok = 1;
+    if (succinct) ok = load_tree_succinct(fp, &back) == 0;
+    else back = len ? load_tree_preorder(fp) : NULL;
+    fclose(fp);
+    free(buf);
+    free_tree(*root);
+    *root = back;
+    return ok;
+}
+
+int fuzz_run(long ops, uint64_t seed) {
+    struct FuzzState *f = (struct FuzzState*)calloc(1, sizeof(struct FuzzState));
+    if (!f) { perror("calloc"); exit(1); }
+    uint64_t x = seed ? seed : 0x9e3779b97f4a7c15ULL;
+    int rc = 0;
+    long i;
+
+    finger_init(&f->finger);
+    hidx_init(&f->index, FUZZ_KEYS * 2);
+    bloom_init(&f->bloom, FUZZ_KEYS);
+    arena_init(&f->arena);
+    ct_init(&f->conc);
+    f->conc_tid = ebr_register(&f->conc.ebr);
+    fuzz_restart_sharded(f);
+
+    double t0 = now_sec();
+    for (i = 0; i < ops && rc == 0; ++i) {
+        uint64_t r = fuzz_next(&x);
+        int key = (int)((r >> 16) % FUZZ_KEYS);
+        unsigned op = (unsigned)(r % 1000);
+        int added;
+
+        if (op < 350) { /* insert */
+            int expect = !f->ref[key];
+            f->ref[key] = 1;
+            f->count += expect;
+            f->base = (op & 1) ? insert_recursive(f->base, key) : insert_iterative(f->base, key);
+            f->fing = finger_insert(&f->finger, f->fing, key);
+            f->indexed = indexed_insert(f->indexed, &f->index, key);
+            bloom_track_insert(&f->bloom, f->indexed, key);
+            f->arena_tree = insert_arena(&f->arena, f->arena_tree, key, &added);
+            if (added != expect) rc = fuzz_fail(i, "insert_arena added flag", key);
+            struct PNode *nv = p_insert(f->version, key);
+            pnode_release(f->version);
+            f->version = nv;
+            if (ct_insert(&f->conc, key) != expect) rc = fuzz_fail(i, "ct_insert result", key);
+        } else if (op < 600) { /* delete */
+            int expect = f->ref[key];
+            f->ref[key] = 0;
+            f->count -= expect;
+            f->base = deleteNode(f->base, key);
+            f->fing = deleteNode(f->fing, key);
+            finger_reset(&f->finger);
+            f->indexed = indexed_delete(f->indexed, &f->index, key);
+            bloom_track_delete(&f->bloom, f->indexed, expect);
+            f->arena_tree = deleteNode_arena(&f->arena, f->arena_tree, key);
+            struct PNode *nv = p_delete(f->version, key);
+            pnode_release(f->version);
+            f->version = nv;
+            if (ct_delete(&f->conc, f->conc_tid, key) != expect) rc = fuzz_fail(i, "ct_delete result", key);
+        } else if (op < 850) { /* exact lookups */
+            int expect = f->ref[key];
+            if ((search_recursive(f->base, key) != NULL) != expect) rc = fuzz_fail(i, "search_recursive", key);
+            else if ((finger_search(&f->finger, f->fing, key) != NULL) != expect) rc = fuzz_fail(i, "finger_search", key);
+            else if ((indexed_search(&f->index, key) != NULL) != expect) rc = fuzz_fail(i, "indexed_search", key);
+            else if ((filtered_search(&f->bloom, f->indexed, NULL, key) != NULL) != expect) rc = fuzz_fail(i, "filtered_search", key);
+            else if ((p_search(f->version, key) != NULL) != expect) rc = fuzz_fail(i, "p_search", key);
+            else if (ct_contains(&f->conc, f->conc_tid, key) != expect) rc = fuzz_fail(i, "ct_contains", key);
+        } else if (op < 995) { /* ordered queries */
+            int ep = ref_neighbour(f->ref, key, -1), es = ref_neighbour(f->ref, key, 1);
+            struct Node *p = predecessor(f->base, key), *q = successor(f->base, key);
+            if ((p ? p->key : -1) != ep) rc = fuzz_fail(i, "predecessor", key);
+            else if ((q ? q->key : -1) != es) rc = fuzz_fail(i, "successor", key);
+            p = predecessor(f->indexed, key);
+            q = successor(f->arena_tree, key);
+            if (!rc && ((p ? p->key : -1) != ep || (q ? q->key : -1) != es))
+                rc = fuzz_fail(i, "pred/succ on variant trees", key);
+            struct Neighbors nb[3];
+            int probe[3] = {key, (key * 7 + 3) % FUZZ_KEYS, FUZZ_KEYS - 1 - key};
+            neighbors_batch(f->fing, probe, 3, nb);
+            if (r >> 63) nb[0] = neighbors(f->base, key); /* single-key form half the time */
+            for (int j = 0; j < 3 && !rc; ++j) {
+                int k = probe[j];
+                int xp = ref_neighbour(f->ref, k, -1), xs = ref_neighbour(f->ref, k, 1);
+                int xf = f->ref[k] ? k : xp, xc = f->ref[k] ? k : xs;
+                struct Node *fl = nb_floor(&nb[j]), *ce = nb_ceiling(&nb[j]);
+                if ((nb[j].pred ? nb[j].pred->key : -1) != xp || (nb[j].succ ? nb[j].succ->key : -1) != xs ||
+                    (fl ? fl->key : -1) != xf || (ce ? ce->key : -1) != xc ||
+                    (nb[j].match != NULL) != f->ref[k])
+                    rc = fuzz_fail(i, j ? "neighbors_batch" : "neighbors", k);
+            }
+        } else if (op < 997) { /* range delete */
+            int lo = key, hi = key + (int)((r >> 40) % 64), removed, expect = 0;
+            for (int k = lo; k <= hi && k < FUZZ_KEYS; ++k) {
+                expect += f->ref[k];
+                if (f->ref[k]) {
+                    f->arena_tree = deleteNode_arena(&f->arena, f->arena_tree, k);
+                    struct PNode *nv = p_delete(f->version, k);
+                    pnode_release(f->version);
+                    f->version = nv;
+                    ct_delete(&f->conc, f->conc_tid, k);
+                }
+                f->ref[k] = 0;
+            }
+            f->count -= expect;
+            f->base = delete_range(f->base, lo, hi, &removed);
+            if (removed != expect) rc = fuzz_fail(i, "delete_range count", key);
+            f->fing = delete_range(f->fing, lo, hi, &removed);
+            finger_reset(&f->finger);
+            f->indexed = delete_range(f->indexed, lo, hi, &removed);
+            hidx_rebuild(&f->index, f->indexed);
+            bloom_rebuild(&f->bloom, f->indexed);
+            if (!rc && !(fuzz_same(f->base, f->ref) && fuzz_same(f->fing, f->ref) &&
+                         fuzz_same(f->indexed, f->ref)))
+                rc = fuzz_fail(i, "delete_range contents", key);
+        } else if (op < 998) { /* predicate delete */
+            int m = (int)((r >> 40) % 10) - 1, removed, expect = 0;
+            for (int k = 0; k < FUZZ_KEYS; ++k) {
+                if (!f->ref[k] || !multiple_of(k, &m)) continue;
+                expect++;
+                f->ref[k] = 0;
+                f->arena_tree = deleteNode_arena(&f->arena, f->arena_tree, k);
+                struct PNode *nv = p_delete(f->version, k);
+                pnode_release(f->version);
+                f->version = nv;
+                ct_delete(&f->conc, f->conc_tid, k);
+            }
+            f->count -= expect;
+            f->base = delete_if(f->base, multiple_of, &m, &removed);
+            if (removed != expect) rc = fuzz_fail(i, "delete_if count", m);
+            f->fing = delete_if(f->fing, multiple_of, &m, &removed);
+            finger_reset(&f->finger);
+            f->indexed = delete_if(f->indexed, multiple_of, &m, &removed);
+            hidx_rebuild(&f->index, f->indexed);
+            bloom_rebuild(&f->bloom, f->indexed);
+            /* m = +-1 matches every key: the trees must come back empty */
+            if (!rc && !(fuzz_same(f->base, f->ref) && fuzz_same(f->fing, f->ref) &&
+                         fuzz_same(f->indexed, f->ref)))
+                rc = fuzz_fail(i, "delete_if contents", m);
+        } else if (op < 999) { /* text save/load on the baseline */
+            if (!fuzz_roundtrip(&f->base, 0)) rc = fuzz_fail(i, "text load", -1);
+        } else { /* succinct save/load on the finger tree; re-pin a version */
+            struct Node *empty = NULL;
+            if (!fuzz_roundtrip(&f->fing, 1)) rc = fuzz_fail(i, "succinct load", -1);
+            else if (!fuzz_roundtrip(&empty, 1) || empty) rc = fuzz_fail(i, "succinct load of empty tree", -1);
+            finger_reset(&f->finger);
+            pnode_release(f->pinned);
+            f->pinned = pnode_retain(f->version);
+            memcpy(f->ref_pinned, f->ref, FUZZ_KEYS);
+        }
+
+        if (!rc && (i & 1023) == 1023) rc = fuzz_check_all(f, i);
+        if (!rc && (i & 1023) == 1023) rc = fuzz_sync_sharded(f, i, r);
+    }
+    if (!rc) rc = fuzz_check_all(f, i);
+    if (!rc) rc = fuzz_sync_sharded(f, i, x);
+    double t1 = now_sec();
+    f->shard_rebalances += atomic_load(&f->sharded.rebalances);
+
+    printf("%ld ops, seed %llu: %s (%.2f M ops/s, %d keys at end, %d shard rebalances)\n", i,
+           (unsigned long long)(seed ? seed : 0x9e3779b97f4a7c15ULL),
+           rc ? "FAILED" : "OK", i / (t1 - t0) / 1e6, f->count, f->shard_rebalances);
+
+    free_tree(f->base);
+    free_tree(f->fing);
+    free_tree(f->indexed);
+    finger_free(&f->finger);
+    hidx_free(&f->index);
+    bloom_free(&f->bloom);
+    arena_destroy(&f->arena);
+    pnode_release(f->version);
+    pnode_release(f->pinned);
+    ct_destroy(&f->conc);
+    sharded_destroy(&f->sharded);
+    free(f);
+    return rc;
+}
+
+/* Menu driver */
+int main(int argc, char **argv) {
+    struct Node* root = NULL;
+    int choice;
+    int key;
+    char fname[128];
+    struct VersionedTree versions;
+    struct Finger finger;
+    struct HashIndex index;
+    int index_on = 0;
+    struct BloomFilter bloom;
+    int bloom_on = 0;
+
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+        return serve_unix(argv[2], argc >= 4 ? argv[3] : NULL);
+    if (argc >= 5 && strcmp(argv[1], "--client") == 0)
+        return client_bench(argv[2], atol(argv[3]), atoi(argv[4]) > 0 ? atoi(argv[4]) : 1);
+    if (argc >= 5 && strcmp(argv[1], "--ebr-stress") == 0)
+        return ebr_stress(atoi(argv[2]), atoi(argv[3]), atof(argv[4]));
+    if (argc >= 3 && strcmp(argv[1], "--fuzz") == 0)
+        return fuzz_run(atol(argv[2]), argc >= 4 ? strtoull(argv[3], NULL, 10) : 0);
+
+    vt_init(&versions);
+    hidx_init(&index, 64);
+    bloom_init(&bloom, 1024);
+    finger_init(&finger);
+    printf("=== Extended BST Program ===\n");
+
+    while (1) {
+        printf("\nMenu:\n");
+        printf("1. Insert (recursive)\n");
+        printf("2. Insert (iterative)\n");
+        printf("3. Search\n");
+        printf("4. Delete\n");
+        printf("5. Traversals (in/pre/post/level)\n");
+        printf("6. Statistics (height, nodes, leaves)\n");
+        printf("7. Find predecessor & successor (floor/ceiling)\n");
+        printf("8. Save tree to file\n");
+        printf("9. Load tree from file (overwrites current)\n");
+        printf("10. Clear tree\n");
+        printf("11. Exit\n");
+        printf("12. Persistent versions (snapshots)\n");
+        printf("13. Insert (finger, from last position)\n");
+        printf("14. Benchmark nearly-sorted inserts\n");
+        printf("15. Shape & access report\n");
+        printf("16. Write shape & access report as JSON\n");
+        printf("17. Delete range [lo, hi]\n");
+        printf("18. Delete all multiples of m\n");
+        printf("19. Toggle hash index for exact lookups\n");
+        printf("20. Benchmark exact lookups (tree vs hash index)\n");
+        printf("21. Toggle Bloom filter for negative lookups\n");
+        printf("22. Bloom filter statistics\n");
+        printf("23. Benchmark negative lookups (tree vs filter)\n");
+        printf("24. Sharded set (multi-threaded)\n");
+        printf("25. Save tree snapshot (succinct binary)\n");
+        printf("26. Load tree snapshot (succinct binary)\n");
+        printf("27. Benchmark snapshot formats\n");
+        printf("28. Benchmark neighbour queries\n");
+        printf("Choice: ");
+        if (scanf("%d", &choice) != 1) {
+            int c;
+            while ((c = getchar()) != '\n' && c != EOF) {}
+            continue;
+        }
+
+        if (choice == 1) {
+            printf("Enter key to insert: ");
+            if (scanf("%d", &key) == 1) {
+                root = insert_recursive(root, key);
+                if (index_on && !hidx_get(&index, key)) hidx_put(&index, key, search_recursive(root, key));
+                if (bloom_on) bloom_track_insert(&bloom, root, key);
+            }
+        } else if (choice == 2) {
+            printf("Enter key to insert (iterative): ");
+            if (scanf("%d", &key) == 1) {
+                if (index_on) root = indexed_insert(root, &index, key);
+                else root = insert_iterative(root, key);
+                if (bloom_on) bloom_track_insert(&bloom, root, key);
+            }
+        } else if (choice == 3) {
+            printf("Enter key to search: ");
+            if (scanf("%d", &key) == 1) {
+                struct Node* found;
+                if (bloom_on) found = filtered_search(&bloom, root, index_on ? &index : NULL, key);
+                else found = index_on ? indexed_search(&index, key) : search_recursive(root, key);
+                if (found) printf("Found key %d\n", found->key);
+                else printf("Key %d not found\n", key);
+            }
+        } else if (choice == 4) {
+            printf("Enter key to delete: ");
+            if (scanf("%d", &key) == 1) {
+                int existed = bloom_on && (index_on ? hidx_get(&index, key) != NULL
+                                                    : search_recursive(root, key) != NULL);
+                if (index_on) root = indexed_delete(root, &index, key);
+                else root = deleteNode(root, key);
+                finger_reset(&finger);
+                if (bloom_on) bloom_track_delete(&bloom, root, existed);
+                printf("Deleted (if existed) %d\n", key);
+            }
+        } else if (choice == 5) {
+            printf("Inorder: ");
+            inorder(root);
+            printf("\nPreorder: ");
+            preorder(root);
+            printf("\nPostorder: ");
+            postorder(root);
+            printf("\nLevel-order: ");
+            levelOrder(root);
+            printf("\n");
+        } else if (choice == 6) {
+            printf("Height: %d\n", height(root));
+            printf("Nodes: %d\n", count_nodes(root));
+            printf("Leaves: %d\n", count_leaves(root));
+        } else if (choice == 7) {
+            printf("Enter key to find pred & succ: ");
+            if (scanf("%d", &key) == 1) {
+                struct Neighbors nb = neighbors(root, key);
+                struct Node *fl = nb_floor(&nb), *ce = nb_ceiling(&nb);
+                if (nb.pred) printf("Predecessor: %d\n", nb.pred->key); else printf("No predecessor\n");
+                if (nb.succ) printf("Successor: %d\n", nb.succ->key); else printf("No successor\n");
+                if (fl) printf("Floor: %d\n", fl->key); else printf("No floor\n");
+                if (ce) printf("Ceiling: %d\n", ce->key); else printf("No ceiling\n");
+            }
+        } else if (choice == 8) {
+            printf("Enter filename to save: ");
+            if (scanf("%127s", fname) == 1) {
+                FILE *fp = fopen(fname, "w");
+                if (!fp) { printf("Failed to open file\n"); }
+                else { save_tree_preorder(fp, root); fclose(fp); printf("Saved\n"); }
+            }
+        } else if (choice == 9) {
+            printf("Enter filename to load: ");
+            if (scanf("%127s", fname) == 1) {
+                FILE *fp = fopen(fname, "r");
+                if (!fp) { printf("Failed to open file\n"); }
+                else {
+                    free_tree(root);
+                    finger_reset(&finger);
+                    root = load_tree_preorder(fp);
+                    fclose(fp);
+                    if (index_on) hidx_rebuild(&index, root);
+                    if (bloom_on) bloom_rebuild(&bloom, root);
+                    printf("Loaded tree from %s\n", fname);
+                }
+            }
+        } else if (choice == 10) {
+            free_tree(root);
+            root = NULL;
+            finger_reset(&finger);
+            hidx_clear(&index);
+            if (bloom_on) bloom_rebuild(&bloom, root);
+            printf("Cleared tree\n");
+        } else if (choice == 11) {
+            printf("Exiting.\n");
+            break;
+        } else if (choice == 12) {
+            versions_menu(&versions, root);
+        } else if (choice == 13) {
+            printf("Enter key to insert (finger): ");
+            if (scanf("%d", &key) == 1) {
+                root = finger_insert(&finger, root, key);
+                if (index_on && !hidx_get(&index, key)) hidx_put(&index, key, finger_search(&finger, root, key));
+                if (bloom_on) bloom_track_insert(&bloom, root, key);
+            }
+        } else if (choice == 14) {
+            int n, jitter;
+            printf("Enter number of keys and jitter: ");
+            if (scanf("%d %d", &n, &jitter) == 2 && n > 0) bench_nearly_sorted(n, jitter);
+        } else if (choice == 15) {
+            shape_report(stdout, root, 0);
+        } else if (choice == 16) {
+            printf("Enter filename for JSON report (- for stdout): ");
+            if (scanf("%127s", fname) == 1) {
+                if (strcmp(fname, "-") == 0) shape_report(stdout, root, 1);
+                else {
+                    FILE *fp = fopen(fname, "w");
+                    if (!fp) { printf("Failed to open file\n"); }
+                    else { shape_report(fp, root, 1); fclose(fp); printf("Saved\n"); }
+                }
+            }
+        } else if (choice == 17) {
+            int lo, hi, removed;
+            printf("Enter lo and hi: ");
+            if (scanf("%d %d", &lo, &hi) == 2) {
+                root = delete_range(root, lo, hi, &removed);
+                finger_reset(&finger);
+                if (index_on) hidx_rebuild(&index, root);
+                if (bloom_on && removed) bloom_rebuild(&bloom, root);
+                printf("Deleted %d keys\n", removed);
+            }
+        } else if (choice == 18) {
+            int m, removed;
+            printf("Enter m: ");
+            if (scanf("%d", &m) == 1) {
+                root = delete_if(root, multiple_of, &m, &removed);
+                finger_reset(&finger);
+                if (index_on) hidx_rebuild(&index, root);
+                if (bloom_on && removed) bloom_rebuild(&bloom, root);
+                printf("Deleted %d keys\n", removed);
+            }
+        } else if (choice == 19) {
+            index_on = !index_on;
+            if (index_on) hidx_rebuild(&index, root);
+            else hidx_clear(&index);
+            printf("Hash index %s\n", index_on ? "enabled" : "disabled");
+        } else if (choice == 20) {
+            int n;
+            printf("Enter number of keys: ");
+            if (scanf("%d", &n) == 1 && n > 0) bench_exact_lookups(n);
+        } else if (choice == 21) {
+            bloom_on = !bloom_on;
+            if (bloom_on) bloom_rebuild(&bloom, root);
+            printf("Bloom filter %s\n", bloom_on ? "enabled" : "disabled");
+        } else if (choice == 22) {
+            bloom_report(&bloom);
+        } else if (choice == 23) {
+            int n;
+            printf("Enter number of keys: ");
+            if (scanf("%d", &n) == 1 && n > 0) bench_negative_lookups(n);
+        } else if (choice == 24) {
+            sharded_menu();
+        } else if (choice == 25) {
+            printf("Enter filename to save: ");
+            if (scanf("%127s", fname) == 1) {
+                FILE *fp = fopen(fname, "wb");
+                if (!fp) { printf("Failed to open file\n"); }
+                else {
+                    int ret = save_tree_succinct(fp, root);
+                    fclose(fp);
+                    printf(ret == 0 ? "Saved\n" : "Failed to save\n");
+                }
+            }
+        } else if (choice == 26) {
+            printf("Enter filename to load: ");
+            if (scanf("%127s", fname) == 1) {
+                FILE *fp = fopen(fname, "rb");
+                if (!fp) { printf("Failed to open file\n"); }
+                else {
+                    struct Node *loaded;
+                    int ret = load_tree_succinct(fp, &loaded);
+                    fclose(fp);
+                    if (ret != 0) printf("Failed to load (err=%d)\n", ret);
+                    else {
+                        free_tree(root);
+                        root = loaded;
+                        finger_reset(&finger);
+                        if (index_on) hidx_rebuild(&index, root);
+                        if (bloom_on) bloom_rebuild(&bloom, root);
+                        printf("Loaded tree from %s\n", fname);
+                    }
+                }
+            }
+        } else if (choice == 27) {
+            int n;
+            printf("Enter number of keys: ");
+            if (scanf("%d", &n) == 1 && n > 0) bench_snapshots(n);
+        } else if (choice == 28) {
+            int n;
+            printf("Enter number of keys: ");
+            if (scanf("%d", &n) == 1 && n > 0) bench_neighbors(n);
         } else {
             printf("Invalid choice.\n");
         }
     }
 
+    bloom_free(&bloom);
+    hidx_free(&index);
+    finger_free(&finger);
+    vt_destroy(&versions);
     free_tree(root);
     return 0;
 }
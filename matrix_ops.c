@@ -1,172 +1,3056 @@
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MAT_X86 1
+#include <immintrin.h>
+#endif
+
+#include "perf_counters.h"
+
+#define MAX_DIM 10000   /* largest rows/cols accepted from input or files */
+#define MAT_ALIGN 64    /* row alignment in bytes (one cache line) */
+#define PRINT_MAX 20    /* larger matrices are printed as a corner */
+#define FNAME_SZ 128
+
+/* Heap matrix, row-major. Each row is padded to stride elements so every
+   row starts on a MAT_ALIGN boundary; padding is kept zeroed. data is
+   either owned heap memory or points into a file mapping (map_len != 0)
+   made by loadMatrixBinary; matrix_free releases whichever it is. */
+struct Matrix {
+    int rows;
+    int cols;
+    int stride;
+    int *data;
+    void *map_base;
+    size_t map_len;
+};
+
+#define MAT(m, i, j) ((m)->data[(size_t)(i) * (m)->stride + (j)])
+
+/* Helper: safe integer input with prompt */
+int safe_int_read(const char *prompt) {
+    int x;
+    int ok;
+    while (1) {
+        printf("%s", prompt);
+        ok = scanf("%d", &x);
+        if (ok == 1) {
+            /* consume newline */
+            int c;
+            while ((c = getchar()) != '\n' && c != EOF) {}
+            return x;
+        } else {
+            printf("Invalid input. Please enter an integer.\n");
+            /* clear input */
+            int c;
+            while ((c = getchar()) != '\n' && c != EOF) {}
+        }
+    }
+}
+
+/* Empty matrix; safe to pass to matrix_resize and matrix_free */
+void matrix_init(struct Matrix *m) {
+    m->rows = m->cols = m->stride = 0;
+    m->data = NULL;
+    m->map_base = NULL;
+    m->map_len = 0;
+}
+
+void matrix_free(struct Matrix *m) {
+    if (m->map_len) munmap(m->map_base, m->map_len);
+    else free(m->data);
+    matrix_init(m);
+}
+
+/* (Re)allocate m for rows x cols without clearing it; a buffer with the
+   same footprint is reused. Returns 0 or -1 (m is then left empty). */
+static int matrix_storage(struct Matrix *m, int rows, int cols) {
+    const int per_line = MAT_ALIGN / (int)sizeof(int);
+    if (rows < 0 || cols < 0 || rows > MAX_DIM || cols > MAX_DIM) return -1;
+    int stride = (cols + per_line - 1) / per_line * per_line;
+    size_t bytes = (size_t)rows * stride * sizeof(int);
+    /* a file mapping is private and writable: it can be reused as is (the
+       result may be one of the inputs), but never resized */
+    if (m->map_len && (size_t)m->rows * m->stride * sizeof(int) != bytes) matrix_free(m);
+    if (!m->data || (size_t)m->rows * m->stride * sizeof(int) != bytes) {
+        free(m->data);
+        m->data = NULL;
+        if (bytes) {
+            m->data = (int*)aligned_alloc(MAT_ALIGN, bytes);
+            if (!m->data) { matrix_init(m); return -1; }
+        }
+    }
+    m->rows = rows;
+    m->cols = cols;
+    m->stride = stride;
+    return 0;
+}
+
+/* (Re)allocate m as a zeroed rows x cols matrix. Returns 0, or -1 if the
+   size is invalid or memory is exhausted (m is then left empty). */
+int matrix_resize(struct Matrix *m, int rows, int cols) {
+    if (matrix_storage(m, rows, cols) != 0) return -1;
+    if (m->data) memset(m->data, 0, (size_t)rows * m->stride * sizeof(int));
+    return 0;
+}
+
+/* matrix_resize for results computed inside the kernels */
+static void matrix_require(struct Matrix *m, int rows, int cols) {
+    if (matrix_resize(m, rows, cols) != 0) {
+        fprintf(stderr, "cannot allocate %d x %d matrix\n", rows, cols);
+        exit(1);
+    }
+}
+
+/* matrix_require for kernels that overwrite every element of the result:
+   skips clearing the interior and only zeroes each row's padding */
+static void matrix_require_overwrite(struct Matrix *m, int rows, int cols) {
+    if (matrix_storage(m, rows, cols) != 0) {
+        fprintf(stderr, "cannot allocate %d x %d matrix\n", rows, cols);
+        exit(1);
+    }
+    if (cols < m->stride)
+        for (int i = 0; i < rows; ++i)
+            memset(&MAT(m, i, cols), 0, (size_t)(m->stride - cols) * sizeof(int));
+}
+
+/* Free dst and move src into it. Kernels that read their inputs while
+   writing the result (products, transposes) use it when res is also an
+   input: resizing res would clear or free the input first, so they
+   compute into a temporary and then replace res with it. */
+static void matrix_replace(struct Matrix *dst, struct Matrix *src) {
+    matrix_free(dst);
+    *dst = *src;
+    matrix_init(src);
+}
+
+/* Print matrix (top-left PRINT_MAX x PRINT_MAX corner of large ones) */
+void printMatrix(const struct Matrix *a) {
+    int r = a->rows < PRINT_MAX ? a->rows : PRINT_MAX;
+    int c = a->cols < PRINT_MAX ? a->cols : PRINT_MAX;
+    for (int i = 0; i < r; ++i) {
+        for (int j = 0; j < c; ++j) {
+            printf("%6d ", MAT(a, i, j));
+        }
+        printf("%s\n", c < a->cols ? "..." : "");
+    }
+    if (r < a->rows || c < a->cols)
+        printf("(showing %d x %d of %d x %d)\n", r, c, a->rows, a->cols);
+}
+
+/* Read matrix elements from stdin; a must already have its size */
+void readMatrix(struct Matrix *a) {
+    for (int i = 0; i < a->rows; ++i) {
+        for (int j = 0; j < a->cols; ++j) {
+            char prompt[64];
+            snprintf(prompt, sizeof(prompt), "Enter element [%d][%d]: ", i, j);
+            MAT(a, i, j) = safe_int_read(prompt);
+        }
+    }
+}
+
+/* Fill matrix with random values in range [-range,range] */
+void randomFill(struct Matrix *a, int range) {
+    for (int i = 0; i < a->rows; ++i)
+        for (int j = 0; j < a->cols; ++j)
+            MAT(a, i, j) = (rand() % (2*range + 1)) - range;
+}
+
+/* Save matrix to a text file (r c then rows) */
+int saveMatrixToFile(const char *fname, const struct Matrix *a) {
+    FILE *fp = fopen(fname, "w");
+    if (!fp) return -1;
+    fprintf(fp, "%d %d\n", a->rows, a->cols);
+    for (int i = 0; i < a->rows; ++i) {
+        for (int j = 0; j < a->cols; ++j) {
+            fprintf(fp, "%d ", MAT(a, i, j));
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* Load matrix from file, resizing a to the stored dimensions */
+int loadMatrixFromFile(const char *fname, struct Matrix *a) {
+    int r, c;
+    FILE *fp = fopen(fname, "r");
+    if (!fp) return -1;
+    if (fscanf(fp, "%d %d", &r, &c) != 2) {
+        fclose(fp);
+        return -2;
+    }
+    if (r < 0 || r > MAX_DIM || c < 0 || c > MAX_DIM || matrix_resize(a, r, c) != 0) {
+        fclose(fp);
+        return -3;
+    }
+    for (int i = 0; i < r; ++i) {
+        for (int j = 0; j < c; ++j) {
+            if (fscanf(fp, "%d", &MAT(a, i, j)) != 1) {
+                fclose(fp);
+                return -4;
+            }
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* Element types for typed matrices and binary files */
+enum ElemType { ELEM_I32, ELEM_I64, ELEM_F32, ELEM_F64 };
+
+static const size_t elem_size[] = { sizeof(int32_t), sizeof(int64_t), sizeof(float), sizeof(double) };
+
+/* Binary matrix files.
+   A 64-byte header followed by the raw rows exactly as they sit in memory
+   (stride elements per row, padding zeroed), starting at a page-aligned
+   offset. Loading maps the file and points the matrix at the payload, so
+   there is nothing to parse and rows keep their MAT_ALIGN alignment.
+   Fields are host byte order; byte_order tells a foreign-endian file
+   apart from a corrupt one. */
+#define MATBIN_MAGIC "MATBIN1"
+#define MATBIN_PAGE 4096
+#define MATBIN_MAX_DIM ((int64_t)1 << 28) /* rows and stride; keeps rows*stride*8 in range */
+
+struct MatFileHeader {
+    char magic[8];          /* MATBIN_MAGIC, NUL padded */
+    uint32_t byte_order;    /* 0x01020304 as written */
+    uint32_t dtype;         /* enum ElemType */
+    int64_t rows;
+    int64_t cols;
+    int64_t stride;         /* elements per stored row */
+    uint64_t payload_offset;
+    uint64_t checksum;      /* matbin_checksum of the payload */
+};
+
+/* Stride for int32 rows of cols elements: cols rounded up to whole
+   MAT_ALIGN lines, as matrix_storage lays them out */
+static int64_t matbin_stride(int64_t cols) {
+    const int64_t per_line = MAT_ALIGN / (int64_t)sizeof(int32_t);
+    return (cols + per_line - 1) / per_line * per_line;
+}
+
+/* 64-bit FNV-1a style hash over 8-byte words; bytes is a multiple of 8.
+   _update continues a hash so payloads can be summed in pieces. */
+#define MATBIN_HASH_INIT 0xcbf29ce484222325ULL
+
+static uint64_t matbin_checksum_update(uint64_t h, const void *data, size_t bytes) {
+    const uint64_t *w = (const uint64_t*)data;
+    for (size_t i = 0; i < bytes / 8; ++i) {
+        h ^= w[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t matbin_checksum(const void *data, size_t bytes) {
+    return matbin_checksum_update(MATBIN_HASH_INIT, data, bytes);
+}
+
+/* Write rows x cols elements of esize bytes laid out with stride.
+   Returns 0 or -1. */
+static int save_binary_raw(const char *fname, uint32_t dtype, size_t esize, int64_t rows,
+                           int64_t cols, int64_t stride, const void *data) {
+    struct MatFileHeader h;
+    size_t bytes = (size_t)rows * stride * esize;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MATBIN_MAGIC, sizeof(MATBIN_MAGIC));
+    h.byte_order = 0x01020304;
+    h.dtype = dtype;
+    h.rows = rows;
+    h.cols = cols;
+    h.stride = stride;
+    h.payload_offset = MATBIN_PAGE;
+    h.checksum = bytes ? matbin_checksum(data, bytes) : 0;
+    FILE *fp = fopen(fname, "wb");
+    if (!fp) return -1;
+    static const char zeros[MATBIN_PAGE];
+    int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+             fwrite(zeros, MATBIN_PAGE - sizeof(h), 1, fp) == 1 &&
+             (bytes == 0 || fwrite(data, bytes, 1, fp) == 1);
+    if (fclose(fp) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+int saveMatrixBinary(const char *fname, const struct Matrix *a) {
+    return save_binary_raw(fname, ELEM_I32, sizeof(int), a->rows, a->cols, a->stride, a->data);
+}
+
+/* Read and check a header. Returns 0, -1 (read), -2 (not a matrix file
+   or foreign byte order) or -3 (bad dimensions, stride or dtype). */
+int read_binary_header(int fd, struct MatFileHeader *h) {
+    if (pread(fd, h, sizeof(*h), 0) != (ssize_t)sizeof(*h)) return -1;
+    if (memcmp(h->magic, MATBIN_MAGIC, sizeof(MATBIN_MAGIC)) != 0 || h->byte_order != 0x01020304)
+        return -2;
+    if (h->rows < 0 || h->cols < 0 || h->stride < h->cols || h->dtype > ELEM_F64 ||
+        h->rows > MATBIN_MAX_DIM || h->stride > MATBIN_MAX_DIM ||
+        h->payload_offset < sizeof(*h) || h->payload_offset % MATBIN_PAGE != 0 ||
+        (h->stride * (int64_t)elem_size[h->dtype]) % MAT_ALIGN != 0)
+        return -3;
+    return 0;
+}
+
+/* Map an int32 binary matrix file into a. The mapping is private and
+   writable, so in-place edits stay in memory and never reach the file.
+   With verify the payload checksum is checked (one read pass).
+   Returns 0, -1 (open), -2/-3 (header, see read_binary_header), -4
+   (truncated), -5 (checksum mismatch), -6 (mmap failed) or -7 (not
+   int32 or larger than MAX_DIM). */
+int loadMatrixBinary(const char *fname, struct Matrix *a, int verify) {
+    struct MatFileHeader h;
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) return -1;
+    int ret = read_binary_header(fd, &h);
+    if (ret != 0) { close(fd); return ret; }
+    if (h.dtype != ELEM_I32 || h.rows > MAX_DIM || h.cols > MAX_DIM ||
+        h.stride != matbin_stride(h.cols)) {
+        close(fd);
+        return -7;
+    }
+    size_t bytes = (size_t)h.rows * h.stride * sizeof(int);
+    if (fstat(fd, &st) != 0 || h.payload_offset > (uint64_t)st.st_size ||
+        bytes > (uint64_t)st.st_size - h.payload_offset) {
+        close(fd);
+        return -4;
+    }
+    size_t len = h.payload_offset + bytes;
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -6;
+    int *data = (int*)((char*)base + h.payload_offset);
+    if (verify && bytes && matbin_checksum(data, bytes) != h.checksum) {
+        munmap(base, len);
+        return -5;
+    }
+    matrix_free(a);
+    a->rows = (int)h.rows;
+    a->cols = (int)h.cols;
+    a->stride = (int)h.stride;
+    a->data = data;
+    a->map_base = base;
+    a->map_len = len;
+    return 0;
+}
+
+/* Elementwise kernels.
+   Operands with equal dimensions share a stride and their row padding is
+   zero, so add/sub/scale can run over the whole buffer (rows * stride) as
+   one flat array: padding stays zero and there is no per-row tail. One
+   implementation per instruction set; simd_init picks the widest one the
+   CPU supports. MATRIX_SIMD=scalar|sse2|avx2|avx512 forces a tier. */
+struct ElemKernels {
+    const char *name;
+    void (*add)(const int *a, const int *b, int *r, size_t n);
+    void (*sub)(const int *a, const int *b, int *r, size_t n);
+    void (*scale)(const int *a, int *r, size_t n, int s);
+};
+
+static void add_scalar(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; ++i) r[i] = a[i] + b[i];
+}
+
+static void sub_scalar(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; ++i) r[i] = a[i] - b[i];
+}
+
+static void scale_scalar(const int *a, int *r, size_t n, int s) {
+    for (size_t i = 0; i < n; ++i) r[i] = a[i] * s;
+}
+
+#ifdef MAT_X86
+/* Buffers are MAT_ALIGN-aligned and n is a multiple of 16, so the SIMD
+   loops use aligned loads and need no remainder handling. */
+static void add_sse2(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i x = _mm_load_si128((const __m128i*)(a + i));
+        __m128i y = _mm_load_si128((const __m128i*)(b + i));
+        _mm_store_si128((__m128i*)(r + i), _mm_add_epi32(x, y));
+    }
+}
+
+static void sub_sse2(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i x = _mm_load_si128((const __m128i*)(a + i));
+        __m128i y = _mm_load_si128((const __m128i*)(b + i));
+        _mm_store_si128((__m128i*)(r + i), _mm_sub_epi32(x, y));
+    }
+}
+
+/* SSE2 has no 32-bit mullo: multiply even and odd lanes as 64-bit
+   products and interleave the low halves back together. */
+static void scale_sse2(const int *a, int *r, size_t n, int s) {
+    __m128i sv = _mm_set1_epi32(s);
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i x = _mm_load_si128((const __m128i*)(a + i));
+        __m128i even = _mm_mul_epu32(x, sv);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), sv);
+        __m128i lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+        _mm_store_si128((__m128i*)(r + i), lo);
+    }
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i x = _mm256_load_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_load_si256((const __m256i*)(b + i));
+        _mm256_store_si256((__m256i*)(r + i), _mm256_add_epi32(x, y));
+    }
+}
+
+__attribute__((target("avx2")))
+static void sub_avx2(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i x = _mm256_load_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_load_si256((const __m256i*)(b + i));
+        _mm256_store_si256((__m256i*)(r + i), _mm256_sub_epi32(x, y));
+    }
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(const int *a, int *r, size_t n, int s) {
+    __m256i sv = _mm256_set1_epi32(s);
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i x = _mm256_load_si256((const __m256i*)(a + i));
+        _mm256_store_si256((__m256i*)(r + i), _mm256_mullo_epi32(x, sv));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void add_avx512(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; i += 16) {
+        __m512i x = _mm512_load_si512((const void*)(a + i));
+        __m512i y = _mm512_load_si512((const void*)(b + i));
+        _mm512_store_si512((void*)(r + i), _mm512_add_epi32(x, y));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void sub_avx512(const int *a, const int *b, int *r, size_t n) {
+    for (size_t i = 0; i < n; i += 16) {
+        __m512i x = _mm512_load_si512((const void*)(a + i));
+        __m512i y = _mm512_load_si512((const void*)(b + i));
+        _mm512_store_si512((void*)(r + i), _mm512_sub_epi32(x, y));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void scale_avx512(const int *a, int *r, size_t n, int s) {
+    __m512i sv = _mm512_set1_epi32(s);
+    for (size_t i = 0; i < n; i += 16) {
+        __m512i x = _mm512_load_si512((const void*)(a + i));
+        _mm512_store_si512((void*)(r + i), _mm512_mullo_epi32(x, sv));
+    }
+}
+#endif
+
+/* Ordered narrowest to widest */
+static const struct ElemKernels elem_tiers[] = {
+    { "scalar", add_scalar, sub_scalar, scale_scalar },
+#ifdef MAT_X86
+    { "sse2", add_sse2, sub_sse2, scale_sse2 },
+    { "avx2", add_avx2, sub_avx2, scale_avx2 },
+    { "avx512", add_avx512, sub_avx512, scale_avx512 },
+#endif
+};
+#define ELEM_TIERS ((int)(sizeof(elem_tiers) / sizeof(elem_tiers[0])))
+
+static const struct ElemKernels *elem = &elem_tiers[0];
+
+/* Nonzero if the running CPU can execute tier t */
+static int simd_supported(int t) {
+#ifdef MAT_X86
+    const char *name = elem_tiers[t].name;
+    if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+#endif
+    return t == 0;
+}
+
+/* Select the elementwise kernels once at startup */
+void simd_init(void) {
+    const char *env = getenv("MATRIX_SIMD");
+#ifdef MAT_X86
+    __builtin_cpu_init();
+#endif
+    elem = &elem_tiers[0];
+    for (int t = 0; t < ELEM_TIERS; ++t) {
+        if (!simd_supported(t)) continue;
+        if (env && strcmp(env, elem_tiers[t].name) == 0) { elem = &elem_tiers[t]; return; }
+        if (!env) elem = &elem_tiers[t];
+    }
+    if (env && strcmp(env, elem->name) != 0)
+        fprintf(stderr, "MATRIX_SIMD=%s not available, using %s\n", env, elem->name);
+}
+
+/* Addition and subtraction (res is resized to a's dimensions). Every
+   element is overwritten from the same position, so res may be a or b. */
+void addMatrix(const struct Matrix *a, const struct Matrix *b, struct Matrix *res) {
+    matrix_require_overwrite(res, a->rows, a->cols);
+    elem->add(a->data, b->data, res->data, (size_t)a->rows * a->stride);
+}
+
+void subMatrix(const struct Matrix *a, const struct Matrix *b, struct Matrix *res) {
+    matrix_require_overwrite(res, a->rows, a->cols);
+    elem->sub(a->data, b->data, res->data, (size_t)a->rows * a->stride);
+}
+
+/* Textbook i-j-k multiply; kept for small inputs and as the benchmark
+   baseline. res may be a or b (see matrix_replace). */
+void multMatrixNaive(const struct Matrix *a, const struct Matrix *b, struct Matrix *res) {
+    if (res == a || res == b) {
+        struct Matrix t;
+        matrix_init(&t);
+        multMatrixNaive(a, b, &t);
+        matrix_replace(res, &t);
+        return;
+    }
+    matrix_require(res, a->rows, b->cols);
+    for (int i = 0; i < a->rows; ++i) {
+        for (int j = 0; j < b->cols; ++j) {
+            int sum = 0;
+            for (int k = 0; k < a->cols; ++k) {
+                sum += MAT(a, i, k) * MAT(b, k, j);
+            }
+            MAT(res, i, j) = sum;
+        }
+    }
+}
+
+/* Tiled GEMM (Goto/BLIS loop order).
+   B is packed KC x NC at a time into NR-wide column panels that stay in L2;
+   A is packed MC x KC into MR-tall row panels sized for L1. The micro-kernel
+   keeps an MR x NR block of C in registers for the whole KC loop, so the
+   inner loop only streams the two packed panels. Edges are zero-padded
+   during packing so the micro-kernel never branches on size. */
+#define GEMM_MR 4
+#define GEMM_NR 8
+#define GEMM_KC 256
+#define GEMM_MC 96
+#define GEMM_NC 2048
+#define GEMM_SMALL (32 * 32 * 32) /* below this many MACs use the naive loop */
+
+typedef int gemm_vec __attribute__((vector_size(GEMM_NR * sizeof(int))));
+
+/* Copy rows [i0, i0+mc) x cols [k0, k0+kc) of a into MR-row panels:
+   panel p, element (i, k) at ap[p*MR*kc + k*MR + i] */
+static void gemm_pack_a(const struct Matrix *a, int i0, int mc, int k0, int kc, int *ap) {
+    for (int ip = 0; ip < mc; ip += GEMM_MR) {
+        int mr = mc - ip < GEMM_MR ? mc - ip : GEMM_MR;
+        for (int k = 0; k < kc; ++k) {
+            int i = 0;
+            for (; i < mr; ++i) ap[i] = MAT(a, i0 + ip + i, k0 + k);
+            for (; i < GEMM_MR; ++i) ap[i] = 0;
+            ap += GEMM_MR;
+        }
+    }
+}
+
+/* Copy rows [k0, k0+kc) x cols [j0, j0+nc) of b into NR-column panels:
+   panel p, element (k, j) at bp[p*NR*kc + k*NR + j] */
+static void gemm_pack_b(const struct Matrix *b, int k0, int kc, int j0, int nc, int *bp) {
+    for (int jp = 0; jp < nc; jp += GEMM_NR) {
+        int nr = nc - jp < GEMM_NR ? nc - jp : GEMM_NR;
+        for (int k = 0; k < kc; ++k) {
+            const int *src = &MAT(b, k0 + k, j0 + jp);
+            int j = 0;
+            for (; j < nr; ++j) bp[j] = src[j];
+            for (; j < GEMM_NR; ++j) bp[j] = 0;
+            bp += GEMM_NR;
+        }
+    }
+}
+
+/* C[0..mr) x [0..nr) += Apanel * Bpanel over kc; c points at C(i, j) */
+static void gemm_micro(int kc, const int *ap, const int *bp, int *c, int ldc, int mr, int nr) {
+    gemm_vec acc[GEMM_MR] = {{0}};
+    for (int k = 0; k < kc; ++k) {
+        gemm_vec bv = *(const gemm_vec*)(bp + k * GEMM_NR);
+        for (int i = 0; i < GEMM_MR; ++i)
+            acc[i] += ap[k * GEMM_MR + i] * bv;
+    }
+    for (int i = 0; i < mr; ++i)
+        for (int j = 0; j < nr; ++j)
+            c[(size_t)i * ldc + j] += acc[i][j];
+}
+
+/* Packing buffers for one thread */
+struct GemmWork {
+    int *ap;
+    int *bp;
+};
+
+static void gemm_work_alloc(struct GemmWork *w, int n) {
+    int nc_max = n < GEMM_NC ? n : GEMM_NC;
+    size_t bsz = (size_t)GEMM_KC * ((nc_max + GEMM_NR - 1) / GEMM_NR * GEMM_NR);
+    size_t asz = (size_t)GEMM_KC * GEMM_MC;
+    w->bp = (int*)aligned_alloc(MAT_ALIGN, bsz * sizeof(int));
+    w->ap = (int*)aligned_alloc(MAT_ALIGN, asz * sizeof(int));
+    if (!w->bp || !w->ap) { perror("aligned_alloc"); exit(1); }
+}
+
+static void gemm_work_free(struct GemmWork *w) {
+    free(w->ap);
+    free(w->bp);
+    w->ap = w->bp = NULL;
+}
+
+/* res rows [r0, r1) x cols [j0, j0+nc) += a rows [r0, r1) x cols [k0, k0+kc)
+   times the KC x NC panel of b already packed at bp */
+static void gemm_block(const struct Matrix *a, const int *bp, struct Matrix *res,
+                       int r0, int r1, int j0, int nc, int k0, int kc, int *ap) {
+    for (int i0 = r0; i0 < r1; i0 += GEMM_MC) {
+        int mc = r1 - i0 < GEMM_MC ? r1 - i0 : GEMM_MC;
+        gemm_pack_a(a, i0, mc, k0, kc, ap);
+        for (int jr = 0; jr < nc; jr += GEMM_NR) {
+            int nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+            const int *bpanel = bp + (size_t)jr * kc;
+            for (int ir = 0; ir < mc; ir += GEMM_MR) {
+                int mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+                gemm_micro(kc, ap + (size_t)ir * kc, bpanel,
+                           &MAT(res, i0 + ir, j0 + jr), res->stride, mr, nr);
+            }
+        }
+    }
+}
+
+/* res rows [r0, r1) += a rows [r0, r1) * b. res must already be sized. */
+static void gemm_rows(const struct Matrix *a, const struct Matrix *b, struct Matrix *res,
+                      int r0, int r1, struct GemmWork *w) {
+    int n = b->cols, kdim = a->cols;
+    for (int j0 = 0; j0 < n; j0 += GEMM_NC) {
+        int nc = n - j0 < GEMM_NC ? n - j0 : GEMM_NC;
+        for (int k0 = 0; k0 < kdim; k0 += GEMM_KC) {
+            int kc = kdim - k0 < GEMM_KC ? kdim - k0 : GEMM_KC;
+            gemm_pack_b(b, k0, kc, j0, nc, w->bp);
+            gemm_block(a, w->bp, res, r0, r1, j0, nc, k0, kc, w->ap);
+        }
+    }
+}
+
+/* res = a * b using the tiled kernel; res may be a or b */
+void multMatrixTiled(const struct Matrix *a, const struct Matrix *b, struct Matrix *res) {
+    struct GemmWork w;
+    if (res == a || res == b) {
+        struct Matrix t;
+        matrix_init(&t);
+        multMatrixTiled(a, b, &t);
+        matrix_replace(res, &t);
+        return;
+    }
+    matrix_require(res, a->rows, b->cols); /* zeroed, so every K block accumulates */
+    if (a->rows == 0 || b->cols == 0 || a->cols == 0) return;
+    gemm_work_alloc(&w, b->cols);
+    gemm_rows(a, b, res, 0, a->rows, &w);
+    gemm_work_free(&w);
+}
+
+/* Persistent worker pool.
+   nthreads counts the caller, which always takes part as worker 0, so a
+   pool of 1 starts no threads. Tasks are assigned statically: worker w
+   runs tasks w, w + nthreads, ... That keeps a given row block on the
+   same thread in every pool_run, which is what first-touch placement
+   relies on (see matrix_resize_on). */
+struct ThreadPool {
+    int nthreads;
+    pthread_t *threads;
+    struct PoolArg *args; /* per-worker start argument */
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+    void (*fn)(void *ctx, int task, int worker);
+    void *ctx;
+    int ntasks;
+    unsigned long generation;
+    int busy;   /* workers (excluding the caller) still in this round */
+    int stop;
+};
+
+struct PoolArg {
+    struct ThreadPool *pool;
+    int id;
+};
+
+static void pool_tasks(struct ThreadPool *p, void (*fn)(void*, int, int), void *ctx,
+                       int ntasks, int id) {
+    for (int t = id; t < ntasks; t += p->nthreads) fn(ctx, t, id);
+}
+
+static void *pool_worker(void *arg) {
+    struct PoolArg *pa = (struct PoolArg*)arg;
+    struct ThreadPool *p = pa->pool;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && p->generation == seen)
+            pthread_cond_wait(&p->start_cv, &p->lock);
+        if (p->stop) break;
+        seen = p->generation;
+        void (*fn)(void*, int, int) = p->fn;
+        void *ctx = p->ctx;
+        int ntasks = p->ntasks;
+        pthread_mutex_unlock(&p->lock);
+        pool_tasks(p, fn, ctx, ntasks, pa->id);
+        pthread_mutex_lock(&p->lock);
+        if (--p->busy == 0) pthread_cond_signal(&p->done_cv);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* Start nthreads - 1 workers. Returns 0, or -1 if no thread could start
+   (the pool then runs everything on the caller). */
+int pool_init(struct ThreadPool *p, int nthreads) {
+    memset(p, 0, sizeof(*p));
+    if (nthreads < 1) nthreads = 1;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start_cv, NULL);
+    pthread_cond_init(&p->done_cv, NULL);
+    p->nthreads = 1;
+    if (nthreads == 1) return 0;
+    p->threads = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    struct PoolArg *args = (struct PoolArg*)malloc(sizeof(struct PoolArg) * nthreads);
+    if (!p->threads || !args) { perror("malloc"); exit(1); }
+    p->args = args;
+    /* nthreads is fixed before any worker starts: they stride by it */
+    p->nthreads = nthreads;
+    int started = 1;
+    for (int i = 1; i < nthreads; ++i) {
+        args[i].pool = p;
+        args[i].id = i;
+        if (pthread_create(&p->threads[i], NULL, pool_worker, &args[i]) != 0) break;
+        ++started;
+    }
+    if (started < nthreads) {
+        /* shut down what did start and fall back to the caller alone */
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->start_cv);
+        pthread_mutex_unlock(&p->lock);
+        for (int i = 1; i < started; ++i) pthread_join(p->threads[i], NULL);
+        free(p->threads);
+        free(args);
+        p->threads = NULL;
+        p->args = NULL;
+        p->stop = 0;
+        p->nthreads = 1;
+        return -1;
+    }
+    return 0;
+}
+
+void pool_destroy(struct ThreadPool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->start_cv);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 1; i < p->nthreads; ++i) pthread_join(p->threads[i], NULL);
+    free(p->threads);
+    free(p->args);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start_cv);
+    pthread_cond_destroy(&p->done_cv);
+    memset(p, 0, sizeof(*p));
+}
+
+/* Run fn(ctx, task, worker) for task in [0, ntasks) and wait for all */
+void pool_run(struct ThreadPool *p, void (*fn)(void *ctx, int task, int worker),
+              void *ctx, int ntasks) {
+    if (p->nthreads == 1 || ntasks <= 1) {
+        for (int t = 0; t < ntasks; ++t) fn(ctx, t, 0);
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->ctx = ctx;
+    p->ntasks = ntasks;
+    p->busy = p->nthreads - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->start_cv);
+    pthread_mutex_unlock(&p->lock);
+
+    pool_tasks(p, fn, ctx, ntasks, 0);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->busy > 0) pthread_cond_wait(&p->done_cv, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Row block handled by one task. Small enough to give every thread about
+   four blocks, a multiple of MR, and at most MC so A packs stay in L1. */
+static int par_block_rows(int rows, int nthreads) {
+    int blk = (rows + 4 * nthreads - 1) / (4 * nthreads);
+    blk = (blk + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+    if (blk > GEMM_MC) blk = GEMM_MC;
+    return blk < GEMM_MR ? GEMM_MR : blk;
+}
+
+struct ZeroJob {
+    struct Matrix *m;
+    int blk;
+};
+
+static void zero_rows_task(void *ctx, int task, int worker) {
+    struct ZeroJob *z = (struct ZeroJob*)ctx;
+    int r0 = task * z->blk;
+    int r1 = r0 + z->blk < z->m->rows ? r0 + z->blk : z->m->rows;
+    (void)worker;
+    memset(&MAT(z->m, r0, 0), 0, (size_t)(r1 - r0) * z->m->stride * sizeof(int));
+}
+
+/* matrix_resize whose zeroing is spread over the pool in the same row
+   blocks the parallel GEMM writes. A fresh allocation's pages are then
+   first touched, and so placed on the NUMA node of, the thread that will
+   later write those rows. Falls back to matrix_resize without a pool. */
+int matrix_resize_on(struct ThreadPool *p, struct Matrix *m, int rows, int cols) {
+    if (!p || p->nthreads == 1) return matrix_resize(m, rows, cols);
+    if (matrix_storage(m, rows, cols) != 0) return -1;
+    if (!m->data) return 0;
+    struct ZeroJob z = { m, par_block_rows(rows, p->nthreads) };
+    pool_run(p, zero_rows_task, &z, (rows + z.blk - 1) / z.blk);
+    return 0;
+}
+
+/* Parallel GEMM shares one packed B panel between all workers, as in
+   the Goto/BLIS scheme: for each (j0, k0) the pool first packs the
+   KC x NC panel of b (each task a run of NR-wide column panels), then
+   each task multiplies its row block of a against it. Row blocks are the
+   par_block_rows split, so a block of res is written by the same worker
+   that first touched it. */
+struct GemmJob {
+    const struct Matrix *a;
+    const struct Matrix *b;
+    struct Matrix *res;
+    int blk;    /* rows per multiply task */
+    int pblk;   /* columns per packing task, a multiple of GEMM_NR */
+    int j0, nc, k0, kc;
+    int *bp;    /* shared packed panel of b */
+    int **ap;   /* one A buffer per worker, allocated on first use */
+};
+
+static void gemm_pack_task(void *ctx, int task, int worker) {
+    struct GemmJob *g = (struct GemmJob*)ctx;
+    int jp = task * g->pblk;
+    int np = g->nc - jp < g->pblk ? g->nc - jp : g->pblk;
+    (void)worker;
+    gemm_pack_b(g->b, g->k0, g->kc, g->j0 + jp, np, g->bp + (size_t)jp * g->kc);
+}
+
+static void gemm_task(void *ctx, int task, int worker) {
+    struct GemmJob *g = (struct GemmJob*)ctx;
+    int r0 = task * g->blk;
+    int r1 = r0 + g->blk < g->a->rows ? r0 + g->blk : g->a->rows;
+    if (!g->ap[worker]) {
+        g->ap[worker] = (int*)aligned_alloc(MAT_ALIGN, (size_t)GEMM_KC * GEMM_MC * sizeof(int));
+        if (!g->ap[worker]) { perror("aligned_alloc"); exit(1); }
+    }
+    gemm_block(g->a, g->bp, g->res, r0, r1, g->j0, g->nc, g->k0, g->kc, g->ap[worker]);
+}
+
+/* res = a * b with row blocks of the output spread over the pool; res may
+   be a or b */
+void multMatrixParallel(struct ThreadPool *p, const struct Matrix *a, const struct Matrix *b,
+                        struct Matrix *res) {
+    int m = a->rows, n = b->cols, kdim = a->cols;
+    if (res == a || res == b) {
+        struct Matrix t;
+        matrix_init(&t);
+        multMatrixParallel(p, a, b, &t);
+        matrix_replace(res, &t);
+        return;
+    }
+    if (matrix_resize_on(p, res, m, n) != 0) {
+        fprintf(stderr, "cannot allocate %d x %d matrix\n", m, n);
+        exit(1);
+    }
+    if (m == 0 || n == 0 || kdim == 0) return;
+    struct GemmJob g = { a, b, res, par_block_rows(m, p->nthreads), 0, 0, 0, 0, 0, NULL, NULL };
+    int nc_max = n < GEMM_NC ? n : GEMM_NC;
+    int npanels = (nc_max + GEMM_NR - 1) / GEMM_NR;
+    g.bp = (int*)aligned_alloc(MAT_ALIGN, (size_t)GEMM_KC * npanels * GEMM_NR * sizeof(int));
+    g.ap = (int**)calloc(p->nthreads, sizeof(int*));
+    if (!g.bp || !g.ap) { perror("malloc"); exit(1); }
+    for (g.j0 = 0; g.j0 < n; g.j0 += GEMM_NC) {
+        g.nc = n - g.j0 < GEMM_NC ? n - g.j0 : GEMM_NC;
+        npanels = (g.nc + GEMM_NR - 1) / GEMM_NR;
+        g.pblk = (npanels + p->nthreads - 1) / p->nthreads * GEMM_NR;
+        for (g.k0 = 0; g.k0 < kdim; g.k0 += GEMM_KC) {
+            g.kc = kdim - g.k0 < GEMM_KC ? kdim - g.k0 : GEMM_KC;
+            pool_run(p, gemm_pack_task, &g, (g.nc + g.pblk - 1) / g.pblk);
+            pool_run(p, gemm_task, &g, (m + g.blk - 1) / g.blk);
+        }
+    }
+    for (int i = 0; i < p->nthreads; ++i) free(g.ap[i]);
+    free(g.ap);
+    free(g.bp);
+}
+
+/* Pool used by multMatrix. Size comes from MATRIX_THREADS, else the number
+   of online CPUs; menu option 16 changes it. */
+static struct ThreadPool mat_pool;
+
+int default_threads(void) {
+    const char *env = getenv("MATRIX_THREADS");
+    if (env && atoi(env) > 0) return atoi(env);
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/* Fast text I/O for the saveMatrixToFile format ("r c" line, then rows
+   of "%d " fields). Same files and error codes as the fscanf versions:
+   - reading uses large read() calls and a hand-written integer parser;
+     fields may be split by any whitespace, as with fscanf.
+   - with a pool of more than one thread the file is mapped and parsed in
+     byte-range chunks: one pass counts the fields in each chunk, a prefix
+     sum gives each chunk its first element index, and a second pass parses
+     straight into place.
+   - writing formats integers through a two-digit table into a large
+     buffer and issues one write() per buffer. */
+#define TEXT_BUF (4 << 20)
+#define TEXT_PAR_MIN (1 << 20) /* smaller files are parsed serially */
+
+static int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* Parse one "%d" field at p (no leading space) that must end at end or at
+   whitespace. Returns the position after it, or NULL if malformed. */
+static const char *parse_int(const char *p, const char *end, int *out) {
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9') return NULL;
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        if (v > 2147483648LL) return NULL;
+    }
+    if (p < end && !is_space(*p)) return NULL;
+    if (neg) v = -v;
+    if (v > INT_MAX) return NULL;
+    *out = (int)v;
+    return p;
+}
+
+/* Buffered reader: [pos, len) of buf is unread, eof once read() returned 0 */
+struct TextReader {
+    int fd;
+    char *buf;
+    size_t pos;
+    size_t len;
+    int eof;
+};
+
+/* Move the unread tail to the front and read until full or EOF */
+static int reader_fill(struct TextReader *r) {
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    while (!r->eof && r->len < TEXT_BUF) {
+        ssize_t got = read(r->fd, r->buf + r->len, TEXT_BUF - r->len);
+        if (got < 0) return -1;
+        if (got == 0) r->eof = 1;
+        r->len += (size_t)got;
+    }
+    return 0;
+}
+
+/* Next field: 1 with *out set, 0 at end of input, -1 if malformed */
+static int reader_next(struct TextReader *r, int *out) {
+    for (;;) {
+        while (r->pos < r->len && is_space(r->buf[r->pos])) ++r->pos;
+        if (r->pos == r->len) {
+            if (r->eof) return 0;
+            if (reader_fill(r) != 0) return -1;
+            continue;
+        }
+        /* make sure the whole field is in the buffer before parsing */
+        size_t e = r->pos;
+        while (e < r->len && !is_space(r->buf[e])) ++e;
+        if (e == r->len && !r->eof && r->pos > 0) {
+            if (reader_fill(r) != 0) return -1;
+            continue;
+        }
+        const char *next = parse_int(r->buf + r->pos, r->buf + e, out);
+        if (!next) return -1;
+        r->pos = (size_t)(next - r->buf);
+        return 1;
+    }
+}
+
+/* One byte range of a mapped file for the parallel parser */
+struct TextChunk {
+    const char *begin;
+    const char *end;
+    long long first;   /* element index of the chunk's first field */
+    long long fields;
+    int bad;           /* a field among the first rows * cols was malformed */
+};
+
+struct TextJob {
+    struct TextChunk *chunks;
+    struct Matrix *m;
+    long long total;   /* rows * cols */
+};
+
+static void text_count_task(void *ctx, int task, int worker) {
+    struct TextChunk *c = &((struct TextJob*)ctx)->chunks[task];
+    const char *p = c->begin;
+    long long n = 0;
+    (void)worker;
+    while (p < c->end) {
+        while (p < c->end && is_space(*p)) ++p;
+        if (p == c->end) break;
+        ++n;
+        while (p < c->end && !is_space(*p)) ++p;
+    }
+    c->fields = n;
+}
+
+static void text_parse_task(void *ctx, int task, int worker) {
+    struct TextJob *job = (struct TextJob*)ctx;
+    struct TextChunk *c = &job->chunks[task];
+    struct Matrix *m = job->m;
+    const char *p = c->begin;
+    long long idx = c->first;
+    (void)worker;
+    if (idx >= job->total || m->cols == 0) return;
+    int i = (int)(idx / m->cols), j = (int)(idx % m->cols);
+    while (p < c->end && idx < job->total) {
+        while (p < c->end && is_space(*p)) ++p;
+        if (p == c->end) break;
+        const char *q = p;
+        while (q < c->end && !is_space(*q)) ++q;
+        if (!parse_int(p, q, &MAT(m, i, j))) { c->bad = 1; return; }
+        p = q;
+        ++idx;
+        if (++j == m->cols) { j = 0; ++i; }
+    }
+}
+
+/* Parse the body [p, end) of a mapped file into m using the pool */
+static int parse_text_parallel(struct ThreadPool *pool, const char *p, const char *end,
+                               struct Matrix *m) {
+    int nchunks = pool->nthreads * 4;
+    struct TextChunk *chunks = (struct TextChunk*)calloc((size_t)nchunks, sizeof(*chunks));
+    if (!chunks) { perror("calloc"); exit(1); }
+    size_t span = (size_t)(end - p) / nchunks;
+    const char *cur = p;
+    for (int k = 0; k < nchunks; ++k) {
+        const char *stop = k == nchunks - 1 ? end : cur + span;
+        if (stop < cur) stop = cur;
+        if (stop > end) stop = end;
+        while (stop < end && !is_space(*stop)) ++stop; /* never split a field */
+        chunks[k].begin = cur;
+        chunks[k].end = stop;
+        cur = stop;
+    }
+    struct TextJob job = { chunks, m, (long long)m->rows * m->cols };
+    pool_run(pool, text_count_task, &job, nchunks);
+    long long first = 0;
+    for (int k = 0; k < nchunks; ++k) {
+        chunks[k].first = first;
+        first += chunks[k].fields;
+    }
+    int ret = first < job.total ? -4 : 0;
+    if (ret == 0) {
+        pool_run(pool, text_parse_task, &job, nchunks);
+        for (int k = 0; k < nchunks; ++k)
+            if (chunks[k].bad) ret = -4;
+    }
+    free(chunks);
+    return ret;
+}
+
+/* loadMatrixFromFile, fast. pool may be NULL (serial). Returns 0, -1
+   (open), -2 (header), -3 (dimensions) or -4 (elements). */
+int loadMatrixText(const char *fname, struct Matrix *a, struct ThreadPool *pool) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (pool && pool->nthreads > 1 && fstat(fd, &st) == 0 && st.st_size >= TEXT_PAR_MIN) {
+        size_t size = (size_t)st.st_size;
+        char *map = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            const char *p = map, *end = map + size;
+            int hdr[2], ret = 0;
+            for (int h = 0; h < 2 && ret == 0; ++h) {
+                while (p < end && is_space(*p)) ++p;
+                const char *q = p;
+                while (q < end && !is_space(*q)) ++q;
+                if (p == end || !parse_int(p, q, &hdr[h])) ret = -2;
+                p = q;
+            }
+            if (ret == 0 && (hdr[0] < 0 || hdr[0] > MAX_DIM || hdr[1] < 0 || hdr[1] > MAX_DIM ||
+                             matrix_storage(a, hdr[0], hdr[1]) != 0))
+                ret = -3;
+            if (ret == 0) {
+                for (int i = 0; i < a->rows; ++i) /* zero the padding */
+                    memset(&MAT(a, i, a->cols), 0, (size_t)(a->stride - a->cols) * sizeof(int));
+                ret = parse_text_parallel(pool, p, end, a);
+            }
+            munmap(map, size);
+            return ret;
+        }
+    }
+
+    struct TextReader r = { fd, (char*)malloc(TEXT_BUF), 0, 0, 0 };
+    if (!r.buf) { perror("malloc"); exit(1); }
+    int rows, cols, ret = 0;
+    if (reader_next(&r, &rows) != 1 || reader_next(&r, &cols) != 1) ret = -2;
+    else if (rows < 0 || rows > MAX_DIM || cols < 0 || cols > MAX_DIM ||
+             matrix_resize(a, rows, cols) != 0) ret = -3;
+    for (int i = 0; ret == 0 && i < rows; ++i)
+        for (int j = 0; j < cols; ++j)
+            if (reader_next(&r, &MAT(a, i, j)) != 1) { ret = -4; break; }
+    free(r.buf);
+    close(fd);
+    return ret;
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Format v into p, returning the number of chars (at most 11) */
+static int format_int(char *p, int v) {
+    char tmp[12];
+    int n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    while (u >= 100) {
+        unsigned d = (u % 100) * 2;
+        u /= 100;
+        tmp[n++] = digit_pairs[d + 1];
+        tmp[n++] = digit_pairs[d];
+    }
+    if (u >= 10) {
+        tmp[n++] = digit_pairs[u * 2 + 1];
+        tmp[n++] = digit_pairs[u * 2];
+    } else {
+        tmp[n++] = (char)('0' + u);
+    }
+    int len = 0;
+    if (v < 0) p[len++] = '-';
+    while (n) p[len++] = tmp[--n];
+    return len;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* saveMatrixToFile, fast; byte-identical output. Returns 0 or -1. */
+int saveMatrixText(const char *fname, const struct Matrix *a) {
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    char *buf = (char*)malloc(TEXT_BUF);
+    if (!buf) { perror("malloc"); exit(1); }
+    size_t n = 0;
+    int ok = 1;
+    n += format_int(buf + n, a->rows);
+    buf[n++] = ' ';
+    n += format_int(buf + n, a->cols);
+    buf[n++] = '\n';
+    for (int i = 0; i < a->rows && ok; ++i) {
+        const int *row = &MAT(a, i, 0);
+        for (int j = 0; j < a->cols; ++j) {
+            if (n > TEXT_BUF - 16) {
+                ok = write_all(fd, buf, n) == 0;
+                n = 0;
+            }
+            n += format_int(buf + n, row[j]);
+            buf[n++] = ' ';
+        }
+        buf[n++] = '\n';
+    }
+    if (ok && n) ok = write_all(fd, buf, n) == 0;
+    free(buf);
+    if (close(fd) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* Text (r c + rows) file -> binary file. Returns 0, the text loader's
+   error code (-1..-4) or -10 if the binary write failed. */
+int convertTextToBinary(const char *text, const char *bin) {
+    struct Matrix m;
+    matrix_init(&m);
+    int ret = loadMatrixText(text, &m, &mat_pool);
+    if (ret == 0 && saveMatrixBinary(bin, &m) != 0) ret = -10;
+    matrix_free(&m);
+    return ret;
+}
+
+/* Monotonic wall clock in seconds */
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Out-of-core multiply.
+   C = A * B where all three are int32 binary files (MATBIN) too large to
+   load. C is produced one T x T tile at a time; each tile accumulates
+   A(i,k) * B(k,j) over the k tiles with the in-memory tiled kernel.
+   Three threads share a fixed set of tile buffers:
+   - a reader walks the same (i, j, k) sequence as the compute loop and
+     fills a ring of OOC_DEPTH (A, B) slots ahead of it (read-ahead);
+   - the caller multiplies tiles as their slot fills;
+   - a writer flushes each finished C tile with pwrite while the next
+     one is computed (two C buffers).
+   Memory use is (2 * OOC_DEPTH + 2) tiles plus packing buffers, whatever
+   the matrix size; T is chosen from the caller's budget. */
+#define OOC_DEPTH 2
+#define OOC_TILES (2 * OOC_DEPTH + 2)
+
+struct OocFile {
+    int fd;
+    struct MatFileHeader h;
+};
+
+struct OocSlot {
+    struct Matrix a;    /* buffers are T x T, views set rows/cols */
+    struct Matrix b;
+};
+
+struct OocJob {
+    struct OocFile fa, fb, fc;
+    int T;
+    int64_t ti, tj, tk;         /* tile counts along m, n and k */
+    int64_t nsteps;             /* ti * tj * tk */
+    struct OocSlot slot[OOC_DEPTH];
+    int64_t produced;           /* steps whose tiles are loaded */
+    int64_t consumed;           /* steps multiplied */
+    struct Matrix c[2];
+    int c_state[2];             /* 0 free, 1 being computed, 2 waiting for the writer */
+    int64_t c_tile[2];          /* tile index i * tj + j */
+    int64_t written;            /* C tiles flushed, in order */
+    int64_t c_total;
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    double bytes_read;
+    double bytes_written;
+};
+
+static int ooc_min(int64_t a, int64_t b) {
+    return (int)(a < b ? a : b);
+}
+
+/* Read the h x w block at (r0, c0) of f into buf rows (stride ld) */
+static int ooc_read_block(const struct OocFile *f, int64_t r0, int64_t c0, int h, int w,
+                          int *buf, int ld) {
+    for (int r = 0; r < h; ++r) {
+        off_t off = (off_t)(f->h.payload_offset + ((r0 + r) * f->h.stride + c0) * sizeof(int));
+        size_t want = (size_t)w * sizeof(int);
+        char *dst = (char*)(buf + (size_t)r * ld);
+        while (want) {
+            ssize_t got = pread(f->fd, dst, want, off);
+            if (got <= 0) return -1;
+            dst += got;
+            off += got;
+            want -= (size_t)got;
+        }
+    }
+    return 0;
+}
+
+static int ooc_write_block(const struct OocFile *f, int64_t r0, int64_t c0, int h, int w,
+                           const int *buf, int ld) {
+    for (int r = 0; r < h; ++r) {
+        off_t off = (off_t)(f->h.payload_offset + ((r0 + r) * f->h.stride + c0) * sizeof(int));
+        size_t want = (size_t)w * sizeof(int);
+        const char *src = (const char*)(buf + (size_t)r * ld);
+        while (want) {
+            ssize_t put = pwrite(f->fd, src, want, off);
+            if (put <= 0) return -1;
+            src += put;
+            off += put;
+            want -= (size_t)put;
+        }
+    }
+    return 0;
+}
+
+/* Step s -> tile coordinates; k varies fastest so one C tile completes
+   before the next starts */
+static void ooc_step(const struct OocJob *j, int64_t s, int64_t *ti, int64_t *tj, int64_t *tk) {
+    *tk = s % j->tk;
+    *tj = (s / j->tk) % j->tj;
+    *ti = s / (j->tk * j->tj);
+}
+
+static void *ooc_reader(void *arg) {
+    struct OocJob *j = (struct OocJob*)arg;
+    int64_t m = j->fa.h.rows, n = j->fb.h.cols, kd = j->fa.h.cols;
+    for (int64_t s = 0; s < j->nsteps; ++s) {
+        pthread_mutex_lock(&j->lock);
+        while (!j->error && s - j->consumed >= OOC_DEPTH) pthread_cond_wait(&j->cv, &j->lock);
+        int stop = j->error;
+        pthread_mutex_unlock(&j->lock);
+        if (stop) break;
+
+        int64_t ti, tj, tk;
+        ooc_step(j, s, &ti, &tj, &tk);
+        struct OocSlot *sl = &j->slot[s % OOC_DEPTH];
+        int64_t i0 = ti * j->T, j0 = tj * j->T, k0 = tk * j->T;
+        sl->a.rows = ooc_min(j->T, m - i0);
+        sl->a.cols = ooc_min(j->T, kd - k0);
+        sl->b.rows = sl->a.cols;
+        sl->b.cols = ooc_min(j->T, n - j0);
+        int bad = ooc_read_block(&j->fa, i0, k0, sl->a.rows, sl->a.cols, sl->a.data, j->T) ||
+                  ooc_read_block(&j->fb, k0, j0, sl->b.rows, sl->b.cols, sl->b.data, j->T);
+
+        pthread_mutex_lock(&j->lock);
+        if (bad) j->error = -5;
+        else j->produced = s + 1;
+        j->bytes_read += 4.0 * ((double)sl->a.rows * sl->a.cols + (double)sl->b.rows * sl->b.cols);
+        pthread_cond_broadcast(&j->cv);
+        pthread_mutex_unlock(&j->lock);
+        if (bad) break;
+    }
+    return NULL;
+}
+
+static void *ooc_writer(void *arg) {
+    struct OocJob *j = (struct OocJob*)arg;
+    int64_t n = j->fb.h.cols, m = j->fa.h.rows;
+    for (int64_t t = 0; t < j->c_total; ++t) {
+        int idx = (int)(t % 2);
+        pthread_mutex_lock(&j->lock);
+        while (!j->error && j->c_state[idx] != 2) pthread_cond_wait(&j->cv, &j->lock);
+        int stop = j->error;
+        pthread_mutex_unlock(&j->lock);
+        if (stop) break;
+
+        int64_t i0 = (j->c_tile[idx] / j->tj) * j->T, j0 = (j->c_tile[idx] % j->tj) * j->T;
+        int h = ooc_min(j->T, m - i0), w = ooc_min(j->T, n - j0);
+        int bad = ooc_write_block(&j->fc, i0, j0, h, w, j->c[idx].data, j->T);
+
+        pthread_mutex_lock(&j->lock);
+        if (bad) j->error = -5;
+        j->c_state[idx] = 0;
+        j->written = t + 1;
+        j->bytes_written += 4.0 * h * w;
+        pthread_cond_broadcast(&j->cv);
+        pthread_mutex_unlock(&j->lock);
+        if (bad) break;
+    }
+    return NULL;
+}
+
+/* Open and validate an int32 MATBIN input */
+static int ooc_open(const char *fname, struct OocFile *f) {
+    f->fd = open(fname, O_RDONLY);
+    if (f->fd < 0) return -1;
+    int ret = read_binary_header(f->fd, &f->h);
+    if (ret == 0 && f->h.dtype != ELEM_I32) ret = -4;
+    if (ret != 0) { close(f->fd); f->fd = -1; }
+    return ret;
+}
+
+/* Create out as a zero-filled int32 MATBIN of rows x cols. The checksum
+   is filled in by ooc_finish_checksum once the payload is complete. */
+static int ooc_create(const char *fname, int64_t rows, int64_t cols, struct OocFile *f) {
+    f->fd = -1;
+    if (rows < 0 || cols < 0 || rows > MATBIN_MAX_DIM || matbin_stride(cols) > MATBIN_MAX_DIM)
+        return -1; /* read_binary_header would reject the file */
+    memset(&f->h, 0, sizeof(f->h));
+    memcpy(f->h.magic, MATBIN_MAGIC, sizeof(MATBIN_MAGIC));
+    f->h.byte_order = 0x01020304;
+    f->h.dtype = ELEM_I32;
+    f->h.rows = rows;
+    f->h.cols = cols;
+    f->h.stride = matbin_stride(cols);
+    f->h.payload_offset = MATBIN_PAGE;
+    f->fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (f->fd < 0) return -1;
+    /* ftruncate leaves a sparse, zeroed payload: row padding is already 0 */
+    if (ftruncate(f->fd, (off_t)(MATBIN_PAGE + rows * f->h.stride * (int64_t)sizeof(int))) != 0 ||
+        pwrite(f->fd, &f->h, sizeof(f->h), 0) != (ssize_t)sizeof(f->h)) {
+        close(f->fd);
+        f->fd = -1;
+        return -5;
+    }
+    return 0;
+}
+
+/* Hash the finished payload with one sequential pass through buf and
+   store it in the header */
+static int ooc_finish_checksum(struct OocFile *f, char *buf, size_t cap) {
+    uint64_t total = (uint64_t)f->h.rows * f->h.stride * sizeof(int), done = 0;
+    uint64_t h = MATBIN_HASH_INIT;
+    cap &= ~(size_t)7;
+    while (done < total) {
+        size_t want = total - done < cap ? (size_t)(total - done) : cap;
+        ssize_t got = pread(f->fd, buf, want, (off_t)(f->h.payload_offset + done));
+        if (got <= 0 || got % 8) return -5;
+        h = matbin_checksum_update(h, buf, (size_t)got);
+        done += (uint64_t)got;
+    }
+    f->h.checksum = total ? h : 0;
+    return pwrite(f->fd, &f->h, sizeof(f->h), 0) == (ssize_t)sizeof(f->h) ? 0 : -5;
+}
+
+/* out = a * b for MATBIN files, using about mem_bytes of memory.
+   Returns 0, -1 (open/create), -2/-3 (bad header), -4 (not int32 or
+   dimensions do not match), -5 (I/O error) or -6 (budget too small). */
+int multiplyOutOfCore(const char *fa, const char *fb, const char *fc, size_t mem_bytes, int verbose) {
+    struct OocJob j;
+    memset(&j, 0, sizeof(j));
+    j.fa.fd = j.fb.fd = j.fc.fd = -1;
+    int ret = ooc_open(fa, &j.fa);
+    if (ret == 0) ret = ooc_open(fb, &j.fb);
+    if (ret == 0 && j.fa.h.cols != j.fb.h.rows) ret = -4;
+
+    /* tile side: largest multiple of 64 whose OOC_TILES buffers fit in
+       the budget after the GEMM packing buffers */
+    size_t pack = sizeof(int) * ((size_t)GEMM_KC * GEMM_NC + (size_t)GEMM_KC * GEMM_MC);
+    int T = 0;
+    if (ret == 0 && mem_bytes > pack) {
+        size_t per = (mem_bytes - pack) / (OOC_TILES * sizeof(int));
+        while ((size_t)(T + 64) * (T + 64) <= per && T + 64 <= 16384) T += 64;
+    }
+    if (ret == 0 && T == 0) ret = -6;
+    if (ret == 0) ret = ooc_create(fc, j.fa.h.rows, j.fb.h.cols, &j.fc);
+    if (ret != 0) {
+        if (j.fa.fd >= 0) close(j.fa.fd);
+        if (j.fb.fd >= 0) close(j.fb.fd);
+        return ret;
+    }
+
+    int64_t m = j.fa.h.rows, n = j.fb.h.cols, kd = j.fa.h.cols;
+    j.T = T;
+    j.ti = (m + T - 1) / T;
+    j.tj = (n + T - 1) / T;
+    j.tk = (kd + T - 1) / T;
+    j.nsteps = j.ti * j.tj * j.tk;
+    j.c_total = j.ti * j.tj;
+    size_t tile_bytes = (size_t)T * T * sizeof(int);
+    struct Matrix *bufs[OOC_TILES];
+    for (int s = 0; s < OOC_DEPTH; ++s) {
+        bufs[2 * s] = &j.slot[s].a;
+        bufs[2 * s + 1] = &j.slot[s].b;
+    }
+    bufs[2 * OOC_DEPTH] = &j.c[0];
+    bufs[2 * OOC_DEPTH + 1] = &j.c[1];
+    for (int t = 0; t < OOC_TILES; ++t) {
+        matrix_init(bufs[t]);
+        bufs[t]->stride = T;
+        bufs[t]->data = (int*)aligned_alloc(MAT_ALIGN, tile_bytes);
+        if (!bufs[t]->data) { perror("aligned_alloc"); exit(1); }
+    }
+    pthread_mutex_init(&j.lock, NULL);
+    pthread_cond_init(&j.cv, NULL);
+    struct GemmWork w;
+    gemm_work_alloc(&w, T);
+
+    double t0 = now_sec();
+    pthread_t reader, writer;
+    int have_k = kd > 0;
+    if (have_k && pthread_create(&reader, NULL, ooc_reader, &j) != 0) { perror("pthread_create"); exit(1); }
+    if (pthread_create(&writer, NULL, ooc_writer, &j) != 0) { perror("pthread_create"); exit(1); }
+
+    /* compute: one C tile per (i, j), accumulated over the k steps */
+    for (int64_t ct = 0; ct < j.c_total; ++ct) {
+        int idx = (int)(ct % 2);
+        pthread_mutex_lock(&j.lock);
+        while (!j.error && j.c_state[idx] != 0) pthread_cond_wait(&j.cv, &j.lock);
+        int stop = j.error;
+        pthread_mutex_unlock(&j.lock);
+        if (stop) break;
+
+        struct Matrix *c = &j.c[idx];
+        c->rows = ooc_min(T, m - (ct / j.tj) * T);
+        c->cols = ooc_min(T, n - (ct % j.tj) * T);
+        for (int r = 0; r < c->rows; ++r) memset(&MAT(c, r, 0), 0, (size_t)c->cols * sizeof(int));
+        for (int64_t k = 0; k < j.tk; ++k) {
+            int64_t s = ct * j.tk + k;
+            pthread_mutex_lock(&j.lock);
+            while (!j.error && j.produced <= s) pthread_cond_wait(&j.cv, &j.lock);
+            stop = j.error;
+            pthread_mutex_unlock(&j.lock);
+            if (stop) break;
+            struct OocSlot *sl = &j.slot[s % OOC_DEPTH];
+            gemm_rows(&sl->a, &sl->b, c, 0, sl->a.rows, &w);
+            pthread_mutex_lock(&j.lock);
+            j.consumed = s + 1;
+            pthread_cond_broadcast(&j.cv);
+            pthread_mutex_unlock(&j.lock);
+        }
+        pthread_mutex_lock(&j.lock);
+        j.c_tile[idx] = ct;
+        j.c_state[idx] = 2;
+        pthread_cond_broadcast(&j.cv);
+        pthread_mutex_unlock(&j.lock);
+        if (verbose && (ct + 1) % 16 == 0)
+            fprintf(stderr, "\r  %lld / %lld tiles", (long long)(ct + 1), (long long)j.c_total);
+    }
+
+    if (have_k) pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    double t1 = now_sec();
+    ret = j.error;
+    if (ret == 0) ret = ooc_finish_checksum(&j.fc, (char*)j.slot[0].a.data, tile_bytes);
+    if (verbose) {
+        if (j.c_total >= 16) fprintf(stderr, "\n");
+        printf("Out-of-core %lld x %lld * %lld x %lld: tile %d, %.1f MiB buffers, %.3f s, %.3f GOP/s\n",
+               (long long)m, (long long)kd, (long long)kd, (long long)n, T,
+               (OOC_TILES * (double)tile_bytes + pack) / (1 << 20), t1 - t0,
+               2.0 * m * n * kd / (t1 - t0) / 1e9);
+        printf("  read %.1f MiB, wrote %.1f MiB\n", j.bytes_read / (1 << 20), j.bytes_written / (1 << 20));
+    }
+
+    gemm_work_free(&w);
+    for (int t = 0; t < OOC_TILES; ++t) free(bufs[t]->data);
+    pthread_mutex_destroy(&j.lock);
+    pthread_cond_destroy(&j.cv);
+    close(j.fa.fd);
+    close(j.fb.fd);
+    if (close(j.fc.fd) != 0 && ret == 0) ret = -5;
+    return ret;
+}
+
+/* Write a rows x cols int32 MATBIN of random values row by row, so files
+   far larger than memory can be made for multiplyOutOfCore.
+   Returns 0, -1 (create) or -5 (write). */
+int createRandomBinary(const char *fname, int64_t rows, int64_t cols, int range) {
+    struct OocFile f;
+    int ret = ooc_create(fname, rows, cols, &f);
+    if (ret != 0) return ret;
+    int64_t stride = f.h.stride;
+    int *row = (int*)aligned_alloc(MAT_ALIGN, (size_t)stride * sizeof(int));
+    if (!row) { perror("aligned_alloc"); exit(1); }
+    memset(row, 0, (size_t)stride * sizeof(int));
+    uint64_t h = MATBIN_HASH_INIT;
+    for (int64_t i = 0; i < rows && ret == 0; ++i) {
+        for (int64_t c = 0; c < cols; ++c) row[c] = (rand() % (2 * range + 1)) - range;
+        size_t bytes = (size_t)stride * sizeof(int);
+        h = matbin_checksum_update(h, row, bytes);
+        off_t off = (off_t)(f.h.payload_offset + i * bytes);
+        if (pwrite(f.fd, row, bytes, off) != (ssize_t)bytes) ret = -5;
+    }
+    f.h.checksum = (rows > 0 && stride > 0) ? h : 0;
+    if (ret == 0 && pwrite(f.fd, &f.h, sizeof(f.h), 0) != (ssize_t)sizeof(f.h)) ret = -5;
+    free(row);
+    if (close(f.fd) != 0 && ret == 0) ret = -5;
+    return ret;
+}
+
+/* Strassen-Winograd.
+   Seven half-size products and fifteen additions per level instead of
+   eight products. Sub-blocks are views (shared data, parent stride), and
+   the per-level temporaries come from one arena sized up front, so the
+   recursion never allocates. Below the crossover size, or for non-square
+   inputs, the tiled kernel does the work. Odd sizes peel the last row and
+   column: the even core recurses and the border is fixed up in O(n^2). */
+static int strassen_enabled = 0;   /* used by multMatrix when set */
+static int strassen_crossover = 512;
+
+struct StrassenArena {
+    int *base;
+    size_t cap;   /* ints */
+    size_t used;
+};
+
+/* rows x cols window of m starting at (r0, c0); no copy */
+static struct Matrix matrix_view(const struct Matrix *m, int r0, int c0, int rows, int cols) {
+    struct Matrix v;
+    matrix_init(&v);
+    v.rows = rows;
+    v.cols = cols;
+    v.stride = m->stride;
+    v.data = m->data + (size_t)r0 * m->stride + c0;
+    return v;
+}
+
+static int strassen_stride(int cols) {
+    const int per_line = MAT_ALIGN / (int)sizeof(int);
+    return (cols + per_line - 1) / per_line * per_line;
+}
+
+/* Arena ints needed by strassen_rec for size n */
+static size_t strassen_workspace(int n, int cutoff) {
+    size_t total = 0;
+    while (n > cutoff) {
+        if (n & 1) { --n; continue; }
+        n /= 2;
+        total += 2 * (size_t)n * strassen_stride(n); /* X and Y */
+    }
+    return total;
+}
+
+static struct Matrix arena_take(struct StrassenArena *ar, int rows, int cols) {
+    struct Matrix v;
+    matrix_init(&v);
+    v.rows = rows;
+    v.cols = cols;
+    v.stride = strassen_stride(cols);
+    v.data = ar->base + ar->used;
+    ar->used += (size_t)rows * v.stride;
+    if (ar->used > ar->cap) { fprintf(stderr, "strassen arena overflow\n"); exit(1); }
+    return v;
+}
+
+/* z = x + y and z = x - y over views; z may alias x or y */
+static void view_add(const struct Matrix *x, const struct Matrix *y, struct Matrix *z) {
+    for (int i = 0; i < z->rows; ++i) {
+        const int *xr = &MAT(x, i, 0), *yr = &MAT(y, i, 0);
+        int *zr = &MAT(z, i, 0);
+        for (int j = 0; j < z->cols; ++j) zr[j] = xr[j] + yr[j];
+    }
+}
+
+static void view_sub(const struct Matrix *x, const struct Matrix *y, struct Matrix *z) {
+    for (int i = 0; i < z->rows; ++i) {
+        const int *xr = &MAT(x, i, 0), *yr = &MAT(y, i, 0);
+        int *zr = &MAT(z, i, 0);
+        for (int j = 0; j < z->cols; ++j) zr[j] = xr[j] - yr[j];
+    }
+}
+
+/* c = a * b with the tiled kernel, c a view that is overwritten */
+static void gemm_view(const struct Matrix *a, const struct Matrix *b, struct Matrix *c,
+                      struct GemmWork *w) {
+    for (int i = 0; i < c->rows; ++i) memset(&MAT(c, i, 0), 0, (size_t)c->cols * sizeof(int));
+    gemm_rows(a, b, c, 0, a->rows, w);
+}
+
+/* c = a * b for square n x n views */
+static void strassen_rec(const struct Matrix *a, const struct Matrix *b, struct Matrix *c,
+                         struct StrassenArena *ar, struct GemmWork *w, int cutoff) {
+    int n = a->rows;
+    if (n <= cutoff) {
+        gemm_view(a, b, c, w);
+        return;
+    }
+    if (n & 1) {
+        int m = n - 1;
+        struct Matrix a11 = matrix_view(a, 0, 0, m, m);
+        struct Matrix b11 = matrix_view(b, 0, 0, m, m);
+        struct Matrix c11 = matrix_view(c, 0, 0, m, m);
+        strassen_rec(&a11, &b11, &c11, ar, w, cutoff);
+        /* C11 += a(:m, m) * b(m, :m) */
+        for (int i = 0; i < m; ++i) {
+            int aim = MAT(a, i, m);
+            const int *br = &MAT(b, m, 0);
+            int *cr = &MAT(c, i, 0);
+            for (int j = 0; j < m; ++j) cr[j] += aim * br[j];
+        }
+        /* last column, then last row, in full */
+        for (int i = 0; i < n; ++i) {
+            int sum = 0;
+            for (int k = 0; k < n; ++k) sum += MAT(a, i, k) * MAT(b, k, m);
+            MAT(c, i, m) = sum;
+        }
+        for (int j = 0; j < m; ++j) MAT(c, m, j) = 0;
+        for (int k = 0; k < n; ++k) {
+            int amk = MAT(a, m, k);
+            const int *br = &MAT(b, k, 0);
+            int *cr = &MAT(c, m, 0);
+            for (int j = 0; j < m; ++j) cr[j] += amk * br[j];
+        }
+        return;
+    }
+
+    int h = n / 2;
+    struct Matrix a11 = matrix_view(a, 0, 0, h, h), a12 = matrix_view(a, 0, h, h, h);
+    struct Matrix a21 = matrix_view(a, h, 0, h, h), a22 = matrix_view(a, h, h, h, h);
+    struct Matrix b11 = matrix_view(b, 0, 0, h, h), b12 = matrix_view(b, 0, h, h, h);
+    struct Matrix b21 = matrix_view(b, h, 0, h, h), b22 = matrix_view(b, h, h, h, h);
+    struct Matrix c11 = matrix_view(c, 0, 0, h, h), c12 = matrix_view(c, 0, h, h, h);
+    struct Matrix c21 = matrix_view(c, h, 0, h, h), c22 = matrix_view(c, h, h, h, h);
+    size_t mark = ar->used;
+    struct Matrix x = arena_take(ar, h, h), y = arena_take(ar, h, h);
+
+    /* Two-temporary schedule (Douglas et al.); comments name the
+       Winograd S/T sums, P products and U partial results. */
+    view_sub(&a11, &a21, &x);                        /* S3 */
+    view_sub(&b22, &b12, &y);                        /* T3 */
+    strassen_rec(&x, &y, &c21, ar, w, cutoff);       /* P7 */
+    view_add(&a21, &a22, &x);                        /* S1 */
+    view_sub(&b12, &b11, &y);                        /* T1 */
+    strassen_rec(&x, &y, &c22, ar, w, cutoff);       /* P5 */
+    view_sub(&x, &a11, &x);                          /* S2 */
+    view_sub(&b22, &y, &y);                          /* T2 */
+    strassen_rec(&x, &y, &c12, ar, w, cutoff);       /* P6 */
+    view_sub(&a12, &x, &x);                          /* S4 */
+    strassen_rec(&x, &b22, &c11, ar, w, cutoff);     /* P3 */
+    strassen_rec(&a11, &b11, &x, ar, w, cutoff);     /* P1 */
+    view_add(&x, &c12, &c12);                        /* U2 = P1 + P6 */
+    view_add(&c12, &c21, &c21);                      /* U3 = U2 + P7 */
+    view_add(&c12, &c22, &c12);                      /* U4 = U2 + P5 */
+    view_add(&c21, &c22, &c22);                      /* U7 = U3 + P5 */
+    view_add(&c12, &c11, &c12);                      /* U5 = U4 + P3 */
+    view_sub(&y, &b21, &y);                          /* T4 */
+    strassen_rec(&a22, &y, &c11, ar, w, cutoff);     /* P4 */
+    view_sub(&c21, &c11, &c21);                      /* U6 = U3 - P4 */
+    strassen_rec(&a12, &b21, &c11, ar, w, cutoff);   /* P2 */
+    view_add(&x, &c11, &c11);                        /* U1 = P1 + P2 */
+
+    ar->used = mark;
+}
+
+/* res = a * b for square a, b via Strassen-Winograd above cutoff; other
+   shapes use the tiled kernel. res may be a or b. */
+void multMatrixStrassen(const struct Matrix *a, const struct Matrix *b, struct Matrix *res,
+                        int cutoff) {
+    int n = a->rows;
+    if (res == a || res == b) {
+        struct Matrix t;
+        matrix_init(&t);
+        multMatrixStrassen(a, b, &t, cutoff);
+        matrix_replace(res, &t);
+        return;
+    }
+    if (n != a->cols || n != b->rows || n != b->cols || n <= cutoff) {
+        multMatrixTiled(a, b, res);
+        return;
+    }
+    if (cutoff < 16) cutoff = 16;
+    matrix_require_overwrite(res, n, n);
+    struct StrassenArena ar;
+    ar.cap = strassen_workspace(n, cutoff);
+    ar.used = 0;
+    ar.base = (int*)aligned_alloc(MAT_ALIGN, (ar.cap ? ar.cap : 16) * sizeof(int));
+    if (!ar.base) { perror("aligned_alloc"); exit(1); }
+    struct GemmWork w;
+    gemm_work_alloc(&w, n);
+    strassen_rec(a, b, res, &ar, &w, cutoff);
+    gemm_work_free(&w);
+    free(ar.base);
+}
+
+/* Multiply a (r1 x c1) by b (c1 x c2) into res (r1 x c2); res may be a or b */
+void multMatrix(const struct Matrix *a, const struct Matrix *b, struct Matrix *res) {
+    long long macs = (long long)a->rows * a->cols * b->cols;
+    if (macs < GEMM_SMALL)
+        multMatrixNaive(a, b, res);
+    else if (strassen_enabled && a->rows == a->cols && b->rows == b->cols &&
+             a->rows > strassen_crossover)
+        multMatrixStrassen(a, b, res, strassen_crossover);
+    else if (mat_pool.nthreads > 1 && macs >= 8LL * GEMM_SMALL && a->rows >= 2 * GEMM_MR)
+        multMatrixParallel(&mat_pool, a, b, res);
+    else
+        multMatrixTiled(a, b, res);
+}
+
+/* Accumulator modes for products.
+   multMatrix keeps int elements and an int accumulator, which wraps once
+   a dot product passes 2^31 (n = 1000 with entries around 1500 already
+   does). The typed layer below computes the same product with a wider
+   accumulator or element type, into a TMatrix of the result type:
+     ACC_INT32       int elements, int accumulator (multMatrix)
+     ACC_INT32_WIDE  int elements read in place, int64 accumulator
+     ACC_INT64       elements widened to int64, int64 accumulator
+     ACC_FLOAT       float elements and accumulator
+     ACC_DOUBLE      double elements and accumulator
+   Each (element, accumulator) pair gets its own kernel from one macro. */
+enum AccMode { ACC_INT32, ACC_INT32_WIDE, ACC_INT64, ACC_FLOAT, ACC_DOUBLE, ACC_MODES };
+
+static const char *const acc_mode_names[ACC_MODES] = {
+    "int32", "int32->int64", "int64", "float", "double"
+};
+
+/* Matrix of any ElemType; same layout rules as struct Matrix */
+struct TMatrix {
+    int rows;
+    int cols;
+    int stride;
+    enum ElemType type;
+    void *data;
+};
+
+void tmatrix_init(struct TMatrix *t) {
+    t->rows = t->cols = t->stride = 0;
+    t->type = ELEM_I32;
+    t->data = NULL;
+}
+
+void tmatrix_free(struct TMatrix *t) {
+    free(t->data);
+    tmatrix_init(t);
+}
+
+/* (Re)allocate t as a zeroed rows x cols matrix of type; 0 or -1 */
+int tmatrix_resize(struct TMatrix *t, enum ElemType type, int rows, int cols) {
+    int per_line = MAT_ALIGN / (int)elem_size[type];
+    if (rows < 0 || cols < 0 || rows > MAX_DIM || cols > MAX_DIM) return -1;
+    int stride = (cols + per_line - 1) / per_line * per_line;
+    size_t bytes = (size_t)rows * stride * elem_size[type];
+    free(t->data);
+    t->data = NULL;
+    if (bytes) {
+        t->data = aligned_alloc(MAT_ALIGN, bytes);
+        if (!t->data) { tmatrix_init(t); return -1; }
+        memset(t->data, 0, bytes);
+    }
+    t->rows = rows;
+    t->cols = cols;
+    t->stride = stride;
+    t->type = type;
+    return 0;
+}
+
+#define TMAT(t, T, i, j) (((T*)(t)->data)[(size_t)(i) * (t)->stride + (j)])
+
+/* Widen an int matrix into dst of the given type */
+static void tmatrix_from_int(const struct Matrix *src, enum ElemType type, struct TMatrix *dst) {
+    if (tmatrix_resize(dst, type, src->rows, src->cols) != 0) {
+        fprintf(stderr, "cannot allocate %d x %d matrix\n", src->rows, src->cols);
+        exit(1);
+    }
+    for (int i = 0; i < src->rows; ++i) {
+        const int *sr = &MAT(src, i, 0);
+        for (int j = 0; j < src->cols; ++j) {
+            switch (type) {
+            case ELEM_I32: TMAT(dst, int32_t, i, j) = sr[j]; break;
+            case ELEM_I64: TMAT(dst, int64_t, i, j) = sr[j]; break;
+            case ELEM_F32: TMAT(dst, float, i, j) = (float)sr[j]; break;
+            case ELEM_F64: TMAT(dst, double, i, j) = sr[j]; break;
+            }
+        }
+    }
+}
+
+/* Type-generic product kernel: c (m x n) = a (m x k) * b (k x n).
+   i-k-j order with a TG_KC x TG_NC block of b held in L2, so the inner
+   loop is a contiguous axpy of one b row into one c row. That loop is
+   written with GCC vector types (TG_VEC bytes of accumulators, elements
+   widened with __builtin_convertvector) so it is SIMD at any -O level.
+   Rows of c are independent, so the macro also defines a pool task that
+   runs the kernel on one row block (same split as multMatrixParallel). */
+#define TG_KC 128
+#define TG_NC 512
+#define TG_VEC 32
+
+/* One typed product spread over mat_pool; element types live in the task */
+struct TypedGemmJob {
+    const void *a;
+    size_t lda;
+    const void *b;
+    size_t ldb;
+    void *c;
+    size_t ldc;
+    int m, n, k;
+    int blk;
+};
+
+#define DEFINE_TYPED_GEMM(SUFFIX, ELEM, ACC)                                    \
+typedef ACC tg_acc_##SUFFIX                                                     \
+    __attribute__((vector_size(TG_VEC), aligned(sizeof(ACC))));                 \
+typedef ELEM tg_elem_##SUFFIX                                                   \
+    __attribute__((vector_size(TG_VEC / sizeof(ACC) * sizeof(ELEM)),            \
+                   aligned(sizeof(ELEM))));                                     \
+static void gemm_##SUFFIX(const ELEM *a, size_t lda, const ELEM *b, size_t ldb, \
+                          ACC *c, size_t ldc, int m, int n, int kdim) {         \
+    const int vl = TG_VEC / (int)sizeof(ACC);                                   \
+    for (int i = 0; i < m; ++i)                                                 \
+        memset(c + i * ldc, 0, (size_t)n * sizeof(ACC));                        \
+    for (int k0 = 0; k0 < kdim; k0 += TG_KC) {                                  \
+        int k1 = kdim - k0 < TG_KC ? kdim : k0 + TG_KC;                         \
+        for (int j0 = 0; j0 < n; j0 += TG_NC) {                                 \
+            int j1 = n - j0 < TG_NC ? n : j0 + TG_NC;                           \
+            for (int i = 0; i < m; ++i) {                                       \
+                ACC *cr = c + i * ldc;                                          \
+                for (int k = k0; k < k1; ++k) {                                 \
+                    ACC aik = (ACC)a[i * lda + k];                              \
+                    const ELEM *br = b + k * ldb;                               \
+                    int j = j0;                                                 \
+                    for (; j + vl <= j1; j += vl) {                             \
+                        tg_acc_##SUFFIX bv = __builtin_convertvector(           \
+                            *(const tg_elem_##SUFFIX*)(br + j), tg_acc_##SUFFIX); \
+                        *(tg_acc_##SUFFIX*)(cr + j) += aik * bv;                \
+                    }                                                           \
+                    for (; j < j1; ++j)                                         \
+                        cr[j] += aik * (ACC)br[j];                              \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+    }                                                                           \
+}                                                                               \
+static void gemm_##SUFFIX##_task(void *ctx, int task, int worker) {             \
+    struct TypedGemmJob *g = (struct TypedGemmJob*)ctx;                         \
+    int r0 = task * g->blk;                                                     \
+    int r1 = r0 + g->blk < g->m ? r0 + g->blk : g->m;                           \
+    (void)worker;                                                               \
+    gemm_##SUFFIX((const ELEM*)g->a + r0 * g->lda, g->lda,                      \
+                  (const ELEM*)g->b, g->ldb,                                    \
+                  (ACC*)g->c + r0 * g->ldc, g->ldc, r1 - r0, g->n, g->k);       \
+}
+
+DEFINE_TYPED_GEMM(i32_i64, int32_t, int64_t)
+DEFINE_TYPED_GEMM(i64, int64_t, int64_t)
+DEFINE_TYPED_GEMM(f32, float, float)
+DEFINE_TYPED_GEMM(f64, double, double)
+
+/* Run one typed product, in row blocks over mat_pool when it is worth it
+   (same thresholds as multMatrix) */
+static void typed_gemm_run(void (*task)(void*, int, int), struct TypedGemmJob *g) {
+    long long macs = (long long)g->m * g->n * g->k;
+    if (mat_pool.nthreads > 1 && macs >= 8LL * GEMM_SMALL && g->m >= 2 * GEMM_MR) {
+        g->blk = par_block_rows(g->m, mat_pool.nthreads);
+        pool_run(&mat_pool, task, g, (g->m + g->blk - 1) / g->blk);
+    } else {
+        g->blk = g->m;
+        task(g, 0, 0);
+    }
+}
 
-#define MAX 10
-#define FNAME_SZ 128
+/* res = a * b in the given mode. ACC_INT32 stores the wrapped int result
+   as int32 so every mode can be printed and compared the same way. */
+void multMatrixAcc(const struct Matrix *a, const struct Matrix *b, enum AccMode mode,
+                   struct TMatrix *res) {
+    static const enum ElemType out_type[ACC_MODES] = {
+        ELEM_I32, ELEM_I64, ELEM_I64, ELEM_F32, ELEM_F64
+    };
+    int m = a->rows, n = b->cols, k = a->cols;
+    if (tmatrix_resize(res, out_type[mode], m, n) != 0) {
+        fprintf(stderr, "cannot allocate %d x %d matrix\n", m, n);
+        exit(1);
+    }
+    if (mode == ACC_INT32) {
+        struct Matrix r;
+        matrix_init(&r);
+        multMatrix(a, b, &r);
+        for (int i = 0; i < m; ++i)
+            memcpy(&TMAT(res, int32_t, i, 0), &MAT(&r, i, 0), (size_t)n * sizeof(int));
+        matrix_free(&r);
+        return;
+    }
+    struct TypedGemmJob g = { a->data, a->stride, b->data, b->stride,
+                              res->data, res->stride, m, n, k, 0 };
+    if (mode == ACC_INT32_WIDE) {
+        /* int already is the element type: no conversion pass */
+        typed_gemm_run(gemm_i32_i64_task, &g);
+        return;
+    }
+    struct TMatrix ta, tb;
+    tmatrix_init(&ta);
+    tmatrix_init(&tb);
+    tmatrix_from_int(a, out_type[mode], &ta);
+    tmatrix_from_int(b, out_type[mode], &tb);
+    g.a = ta.data;
+    g.lda = ta.stride;
+    g.b = tb.data;
+    g.ldb = tb.stride;
+    if (mode == ACC_INT64)
+        typed_gemm_run(gemm_i64_task, &g);
+    else if (mode == ACC_FLOAT)
+        typed_gemm_run(gemm_f32_task, &g);
+    else
+        typed_gemm_run(gemm_f64_task, &g);
+    tmatrix_free(&ta);
+    tmatrix_free(&tb);
+}
 
-/* Helper: safe integer input with prompt */
-int safe_int_read(const char *prompt) {
-    int x;
-    int ok;
-    while (1) {
-        printf("%s", prompt);
-        ok = scanf("%d", &x);
-        if (ok == 1) {
-            /* consume newline */
-            int c;
-            while ((c = getchar()) != '\n' && c != EOF) {}
-            return x;
-        } else {
-            printf("Invalid input. Please enter an integer.\n");
-            /* clear input */
-            int c;
-            while ((c = getchar()) != '\n' && c != EOF) {}
-        }
+/* Element (i, j) of t as double, for comparisons across types */
+double tmatrix_get(const struct TMatrix *t, int i, int j) {
+    switch (t->type) {
+    case ELEM_I32: return TMAT(t, int32_t, i, j);
+    case ELEM_I64: return (double)TMAT(t, int64_t, i, j);
+    case ELEM_F32: return TMAT(t, float, i, j);
+    case ELEM_F64: return TMAT(t, double, i, j);
     }
+    return 0;
 }
 
-/* Print matrix */
-void printMatrix(int a[MAX][MAX], int r, int c) {
+/* printMatrix for any element type */
+void printTMatrix(const struct TMatrix *t) {
+    int r = t->rows < PRINT_MAX ? t->rows : PRINT_MAX;
+    int c = t->cols < PRINT_MAX ? t->cols : PRINT_MAX;
     for (int i = 0; i < r; ++i) {
         for (int j = 0; j < c; ++j) {
-            printf("%6d ", a[i][j]);
+            if (t->type == ELEM_I32) printf("%6d ", TMAT(t, int32_t, i, j));
+            else if (t->type == ELEM_I64) printf("%12lld ", (long long)TMAT(t, int64_t, i, j));
+            else printf("%12.6g ", tmatrix_get(t, i, j));
         }
-        printf("\n");
+        printf("%s\n", c < t->cols ? "..." : "");
     }
+    if (r < t->rows || c < t->cols)
+        printf("(showing %d x %d of %d x %d)\n", r, c, t->rows, t->cols);
 }
 
-/* Read matrix from stdin */
-void readMatrix(int a[MAX][MAX], int r, int c) {
-    for (int i = 0; i < r; ++i) {
-        for (int j = 0; j < c; ++j) {
-            char prompt[64];
-            snprintf(prompt, sizeof(prompt), "Enter element [%d][%d]: ", i, j);
-            a[i][j] = safe_int_read(prompt);
+/* Nonzero if an int accumulator could overflow for a * b: the largest
+   possible |dot product| is max|a| * max|b| * k. */
+int int_product_may_overflow(const struct Matrix *a, const struct Matrix *b) {
+    long long ma = 0, mb = 0;
+    for (int i = 0; i < a->rows; ++i)
+        for (int j = 0; j < a->cols; ++j) {
+            long long v = MAT(a, i, j);
+            if (v < 0) v = -v;
+            if (v > ma) ma = v;
+        }
+    for (int i = 0; i < b->rows; ++i)
+        for (int j = 0; j < b->cols; ++j) {
+            long long v = MAT(b, i, j);
+            if (v < 0) v = -v;
+            if (v > mb) mb = v;
+        }
+    /* ma, mb <= 2^31, so compare in double to avoid overflowing here */
+    return (double)ma * (double)mb * a->cols > 2147483647.0;
+}
+
+/* Scalar multiply; res may be a */
+void scalarMultiply(const struct Matrix *a, struct Matrix *res, int scalar) {
+    matrix_require_overwrite(res, a->rows, a->cols);
+    elem->scale(a->data, res->data, (size_t)a->rows * a->stride, scalar);
+}
+
+void transposeInPlace(struct Matrix *a);
+
+/* Element-by-element transpose; the benchmark baseline for transpose.
+   res == a transposes in place. */
+void transposeNaive(const struct Matrix *a, struct Matrix *res) {
+    if (res == a) { transposeInPlace(res); return; }
+    matrix_require_overwrite(res, a->cols, a->rows);
+    for (int i = 0; i < a->rows; ++i)
+        for (int j = 0; j < a->cols; ++j)
+            MAT(res, j, i) = MAT(a, i, j);
+}
+
+/* Blocked transpose.
+   The naive loop writes res column-wise, touching a new cache line (and,
+   for big matrices, a new page) on every store. Here the matrix is walked
+   in TR_TILE x TR_TILE tiles whose source and destination lines both fit
+   in L1, and each tile is moved as 4x4 blocks transposed in registers.
+   Block corners sit on multiples of 4 and strides on multiples of 16, so
+   all loads and stores are aligned. */
+#define TR_TILE 16
+
+/* dst (ld) = transpose of the 4x4 block at src (ls) */
+static void tr4x4(const int *src, int ls, int *dst, int ld) {
+#ifdef __SSE2__
+    __m128i r0 = _mm_load_si128((const __m128i*)src);
+    __m128i r1 = _mm_load_si128((const __m128i*)(src + ls));
+    __m128i r2 = _mm_load_si128((const __m128i*)(src + 2 * ls));
+    __m128i r3 = _mm_load_si128((const __m128i*)(src + 3 * ls));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1); /* a0 b0 a1 b1 */
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3); /* c0 d0 c1 d1 */
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1); /* a2 b2 a3 b3 */
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3); /* c2 d2 c3 d3 */
+    _mm_store_si128((__m128i*)dst, _mm_unpacklo_epi64(t0, t1));
+    _mm_store_si128((__m128i*)(dst + ld), _mm_unpackhi_epi64(t0, t1));
+    _mm_store_si128((__m128i*)(dst + 2 * ld), _mm_unpacklo_epi64(t2, t3));
+    _mm_store_si128((__m128i*)(dst + 3 * ld), _mm_unpackhi_epi64(t2, t3));
+#else
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            dst[j * ld + i] = src[i * ls + j];
+#endif
+}
+
+/* Transpose (r x c -> c x r); res == a transposes in place */
+void transpose(const struct Matrix *a, struct Matrix *res) {
+    int r4 = a->rows & ~3, c4 = a->cols & ~3;
+    if (res == a) { transposeInPlace(res); return; }
+    matrix_require_overwrite(res, a->cols, a->rows);
+    for (int ib = 0; ib < r4; ib += TR_TILE) {
+        int ie = ib + TR_TILE < r4 ? ib + TR_TILE : r4;
+        for (int jb = 0; jb < c4; jb += TR_TILE) {
+            int je = jb + TR_TILE < c4 ? jb + TR_TILE : c4;
+            for (int i = ib; i < ie; i += 4)
+                for (int j = jb; j < je; j += 4)
+                    tr4x4(&MAT(a, i, j), a->stride, &MAT(res, j, i), res->stride);
         }
     }
+    /* ragged right columns and bottom rows */
+    for (int i = 0; i < r4; ++i)
+        for (int j = c4; j < a->cols; ++j)
+            MAT(res, j, i) = MAT(a, i, j);
+    for (int i = r4; i < a->rows; ++i)
+        for (int j = 0; j < a->cols; ++j)
+            MAT(res, j, i) = MAT(a, i, j);
 }
 
-/* Fill matrix with random values in range [-range,range] */
-void randomFill(int a[MAX][MAX], int r, int c, int range) {
-    for (int i = 0; i < r; ++i)
-        for (int j = 0; j < c; ++j)
-            a[i][j] = (rand() % (2*range + 1)) - range;
+/* Transpose a in place. Square matrices swap mirrored 4x4 blocks tile by
+   tile with no extra buffer; other shapes go through a temporary. */
+void transposeInPlace(struct Matrix *a) {
+    if (a->rows != a->cols) {
+        struct Matrix t;
+        matrix_init(&t);
+        transpose(a, &t);
+        matrix_free(a);
+        *a = t;
+        return;
+    }
+    int n = a->rows, n4 = n & ~3, ls = a->stride;
+    int tmp[16] __attribute__((aligned(16)));
+    for (int ib = 0; ib < n4; ib += TR_TILE) {
+        int ie = ib + TR_TILE < n4 ? ib + TR_TILE : n4;
+        for (int jb = ib; jb < n4; jb += TR_TILE) {
+            int je = jb + TR_TILE < n4 ? jb + TR_TILE : n4;
+            for (int i = ib; i < ie; i += 4) {
+                for (int j = (jb == ib ? i : jb); j < je; j += 4) {
+                    int *x = &MAT(a, i, j), *y = &MAT(a, j, i);
+                    tr4x4(x, ls, tmp, 4);
+                    if (x != y) tr4x4(y, ls, x, ls);
+                    for (int k = 0; k < 4; ++k)
+                        memcpy(y + (size_t)k * ls, tmp + 4 * k, 4 * sizeof(int));
+                }
+            }
+        }
+    }
+    /* pairs with a row or column index past the last whole block */
+    for (int i = n4; i < n; ++i) {
+        for (int j = 0; j < i; ++j) {
+            int t = MAT(a, i, j);
+            MAT(a, i, j) = MAT(a, j, i);
+            MAT(a, j, i) = t;
+        }
+    }
 }
 
-/* Save matrix to a text file (r c then rows) */
-int saveMatrixToFile(const char *fname, int a[MAX][MAX], int r, int c) {
-    FILE *fp = fopen(fname, "w");
-    if (!fp) return -1;
-    fprintf(fp, "%d %d\n", r, c);
-    for (int i = 0; i < r; ++i) {
-        for (int j = 0; j < c; ++j) {
-            fprintf(fp, "%d ", a[i][j]);
+/* Helper: copy matrix. One flat memcpy; libc already dispatches it to
+   the widest vector moves the CPU has. */
+void copyMatrix(const struct Matrix *src, struct Matrix *dst) {
+    if (dst == src) return;
+    matrix_require_overwrite(dst, src->rows, src->cols);
+    if (src->data)
+        memcpy(dst->data, src->data, (size_t)src->rows * src->stride * sizeof(int));
+}
+
+/* Determinant.
+   Integer inputs first go through Bareiss fraction-free elimination in
+   128-bit arithmetic: every intermediate is a minor of the input, each
+   division is exact, and the result is exact unless some step overflows.
+   On overflow (large or wide-ranged matrices) it falls back to LU with
+   partial pivoting in double, reporting |det| as mantissa * 10^exp so
+   values far beyond DBL_MAX still print. Both paths are O(n^3). */
+struct Determinant {
+    int exact;        /* value holds the exact determinant */
+    __int128 value;
+    int sign;         /* -1, 0 or 1 (both paths) */
+    double mantissa;  /* floating path: |det| ~= mantissa * 10^exp10 */
+    long exp10;
+};
+
+/* Exact determinant into *out. Returns 0, or -1 if a value left 128 bits. */
+int determinant_bareiss(const struct Matrix *mat, __int128 *out) {
+    int n = mat->rows;
+    __int128 *m = (__int128*)malloc(sizeof(__int128) * (size_t)n * n);
+    if (!m) { perror("malloc"); exit(1); }
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            m[(size_t)i * n + j] = MAT(mat, i, j);
+
+    __int128 prev = 1;
+    int sign = 1;
+    int ret = 0;
+    for (int k = 0; k < n - 1 && ret == 0; ++k) {
+        __int128 *rk = m + (size_t)k * n;
+        if (rk[k] == 0) {
+            int p = k + 1;
+            while (p < n && m[(size_t)p * n + k] == 0) ++p;
+            if (p == n) { *out = 0; free(m); return 0; }
+            __int128 *rp = m + (size_t)p * n;
+            for (int j = k; j < n; ++j) { __int128 t = rk[j]; rk[j] = rp[j]; rp[j] = t; }
+            sign = -sign;
         }
-        fprintf(fp, "\n");
+        __int128 piv = rk[k];
+        for (int i = k + 1; i < n && ret == 0; ++i) {
+            __int128 *ri = m + (size_t)i * n;
+            __int128 f = ri[k];
+            if (f == 0 && piv == prev) continue; /* row is unchanged */
+            for (int j = k + 1; j < n; ++j) {
+                __int128 x, y;
+                if (__builtin_mul_overflow(ri[j], piv, &x) ||
+                    __builtin_mul_overflow(f, rk[j], &y) ||
+                    __builtin_sub_overflow(x, y, &x)) {
+                    ret = -1;
+                    break;
+                }
+                ri[j] = prev == 1 ? x : x / prev;
+            }
+        }
+        prev = piv;
     }
-    fclose(fp);
+    if (ret == 0) *out = n == 0 ? 1 : sign * m[(size_t)(n - 1) * n + (n - 1)];
+    free(m);
+    return ret;
+}
+
+/* Keep mantissa in [1, 10), moving powers of ten into *exp10 */
+static double normalize10(double x, long *exp10) {
+    while (x >= 10.0) { x /= 10.0; ++*exp10; }
+    while (x < 1.0) { x *= 10.0; --*exp10; }
+    return x;
+}
+
+/* LU with partial pivoting in double. Pivots below n * eps * max|a|
+   count as zero, so numerically singular matrices report 0. */
+void determinant_lu(const struct Matrix *mat, struct Determinant *d) {
+    int n = mat->rows;
+    double *m = (double*)malloc(sizeof(double) * (size_t)n * n);
+    double **row = (double**)malloc(sizeof(double*) * (size_t)(n ? n : 1));
+    if (!m || !row) { perror("malloc"); exit(1); }
+    double amax = 0;
+    for (int i = 0; i < n; ++i) {
+        row[i] = m + (size_t)i * n;
+        for (int j = 0; j < n; ++j) {
+            row[i][j] = MAT(mat, i, j);
+            double v = row[i][j] < 0 ? -row[i][j] : row[i][j];
+            if (v > amax) amax = v;
+        }
+    }
+    double tiny = amax * n * 2.220446049250313e-16; /* DBL_EPSILON */
+    d->exact = 0;
+    d->sign = 1;
+    d->mantissa = 1.0;
+    d->exp10 = 0;
+    for (int k = 0; k < n; ++k) {
+        int p = k;
+        double best = row[k][k] < 0 ? -row[k][k] : row[k][k];
+        for (int i = k + 1; i < n; ++i) {
+            double v = row[i][k] < 0 ? -row[i][k] : row[i][k];
+            if (v > best) { best = v; p = i; }
+        }
+        if (best <= tiny) { d->sign = 0; break; }
+        if (p != k) {
+            double *t = row[k]; row[k] = row[p]; row[p] = t;
+            d->sign = -d->sign;
+        }
+        double *rk = row[k];
+        double piv = rk[k];
+        if (piv < 0) d->sign = -d->sign;
+        d->mantissa = normalize10(d->mantissa * best, &d->exp10);
+        for (int i = k + 1; i < n; ++i) {
+            double *ri = row[i];
+            double f = ri[k] / piv;
+            if (f == 0.0) continue;
+            for (int j = k + 1; j < n; ++j) ri[j] -= f * rk[j];
+        }
+    }
+    if (d->sign == 0) { d->mantissa = 0; d->exp10 = 0; }
+    free(row);
+    free(m);
+}
+
+/* Exact when it fits in 128 bits, floating-point otherwise */
+void determinant(const struct Matrix *mat, struct Determinant *d) {
+    if (determinant_bareiss(mat, &d->value) == 0) {
+        d->exact = 1;
+        d->sign = d->value > 0 ? 1 : (d->value < 0 ? -1 : 0);
+        d->mantissa = 0;
+        d->exp10 = 0;
+    } else {
+        determinant_lu(mat, d);
+    }
+}
+
+/* Print a signed 128-bit integer in decimal */
+void print_i128(__int128 v) {
+    char buf[48];
+    int pos = sizeof(buf) - 1;
+    unsigned __int128 u = v < 0 ? -(unsigned __int128)v : (unsigned __int128)v;
+    buf[pos] = '\0';
+    do { buf[--pos] = (char)('0' + (int)(u % 10)); u /= 10; } while (u);
+    if (v < 0) buf[--pos] = '-';
+    printf("%s", buf + pos);
+}
+
+void printDeterminant(const struct Determinant *d) {
+    if (d->exact) {
+        print_i128(d->value);
+    } else if (d->sign == 0) {
+        printf("0 (numerically singular, floating-point LU)");
+    } else {
+        printf("%s%.15fe%+ld (floating-point LU; exact 128-bit path overflowed)",
+               d->sign < 0 ? "-" : "", d->mantissa, d->exp10);
+    }
+}
+
+static void perf_attach_task(void *ctx, int task, int worker) {
+    (void)task;
+    if (worker > 0) perf_add_thread((struct PerfCounters*)ctx, worker);
+}
+
+/* perf_open, plus a counter group on each worker of p: the pool threads
+   predate the counters, so inherit does not cover them. One task per
+   thread lands task i on worker i. */
+static void perf_open_pool(struct PerfCounters *pc, struct ThreadPool *p) {
+    perf_open(pc);
+    if (pc->enabled && p->nthreads > 1) pool_run(p, perf_attach_task, pc, p->nthreads);
+}
+
+/* Time repeated multMatrix calls; hardware counters with PERF_COUNTERS=1
+   cover the caller and every pool worker */
+void benchMultiply(const struct Matrix *a, const struct Matrix *b, int iters) {
+    struct Matrix res;
+    struct PerfCounters pc;
+    long long check = 0;
+    matrix_init(&res);
+    perf_open_pool(&pc, &mat_pool);
+
+    perf_start(&pc);
+    double t0 = now_sec();
+    for (int it = 0; it < iters; ++it) {
+        multMatrix(a, b, &res);
+        check += MAT(&res, it % res.rows, it % res.cols);
+    }
+    double t1 = now_sec();
+    perf_stop(&pc);
+
+    double ops = 2.0 * a->rows * a->cols * b->cols;
+    printf("multMatrix %dx%d * %dx%d: %.1f ns/call, %.3f GOP/s (check %lld)\n",
+           a->rows, a->cols, b->rows, b->cols, (t1 - t0) * 1e9 / iters,
+           ops * iters / (t1 - t0) / 1e9, check);
+    perf_report(&pc, "multMatrix", iters);
+    perf_close(&pc);
+    matrix_free(&res);
+}
+
+/* Nonzero if a and b hold the same values */
+int matrix_equal(const struct Matrix *a, const struct Matrix *b) {
+    if (a->rows != b->rows || a->cols != b->cols) return 0;
+    if (a->cols == 0) return 1;
+    for (int i = 0; i < a->rows; ++i)
+        if (memcmp(&MAT(a, i, 0), &MAT(b, i, 0), (size_t)a->cols * sizeof(int)) != 0)
+            return 0;
+    return 1;
+}
+
+/* Run fn(a, b, res) until at least 0.2 s has passed; seconds per call */
+static double time_multiply(void (*fn)(const struct Matrix*, const struct Matrix*, struct Matrix*),
+                            const struct Matrix *a, const struct Matrix *b, struct Matrix *res,
+                            struct PerfCounters *pc, int *calls) {
+    int n = 0;
+    perf_start(pc);
+    double t0 = now_sec(), t1;
+    do {
+        fn(a, b, res);
+        ++n;
+        t1 = now_sec();
+    } while (t1 - t0 < 0.2);
+    perf_stop(pc);
+    *calls = n;
+    return (t1 - t0) / n;
+}
+
+/* Square n x n sweep from 64 to max_n: naive vs tiled GOP/s (2*n^3 ops).
+   The naive loop is skipped above naive_max because it takes minutes. */
+void benchGemm(int max_n, int naive_max) {
+    struct Matrix a, b, r1, r2;
+    struct PerfCounters pc;
+    matrix_init(&a); matrix_init(&b); matrix_init(&r1); matrix_init(&r2);
+    perf_open(&pc);
+    printf("%6s %12s %12s %8s\n", "n", "naive GOP/s", "tiled GOP/s", "check");
+    for (int n = 64; n <= max_n; n *= 2) {
+        matrix_require(&a, n, n);
+        matrix_require(&b, n, n);
+        randomFill(&a, 100);
+        randomFill(&b, 100);
+        double ops = 2.0 * n * n * n;
+        int calls;
+        char label[32];
+
+        double naive = 0;
+        if (n <= naive_max)
+            naive = ops / time_multiply(multMatrixNaive, &a, &b, &r1, &pc, &calls) / 1e9;
+        double tiled = ops / time_multiply(multMatrixTiled, &a, &b, &r2, &pc, &calls) / 1e9;
+        if (n <= naive_max)
+            printf("%6d %12.3f %12.3f %8s\n", n, naive, tiled,
+                   matrix_equal(&r1, &r2) ? "ok" : "MISMATCH");
+        else
+            printf("%6d %12s %12.3f %8s\n", n, "-", tiled, "-");
+        snprintf(label, sizeof(label), "tiled n=%d", n);
+        perf_report(&pc, label, calls);
+        fflush(stdout);
+    }
+    perf_close(&pc);
+    matrix_free(&a); matrix_free(&b); matrix_free(&r1); matrix_free(&r2);
+}
+
+/* add/scale throughput of every supported tier on an n x n matrix.
+   Bytes counted as moved: 3 ints per element for add, 2 for scale. */
+void benchElementwise(int n) {
+    struct Matrix a, b, r;
+    matrix_init(&a); matrix_init(&b); matrix_init(&r);
+    matrix_require(&a, n, n);
+    matrix_require(&b, n, n);
+    matrix_require(&r, n, n);
+    randomFill(&a, 1000);
+    randomFill(&b, 1000);
+    size_t len = (size_t)n * a.stride;
+    const struct ElemKernels *saved = elem;
+    printf("%-8s %12s %12s\n", "tier", "add GB/s", "scale GB/s");
+    for (int t = 0; t < ELEM_TIERS; ++t) {
+        if (!simd_supported(t)) continue;
+        const struct ElemKernels *k = &elem_tiers[t];
+        int reps = 0;
+        double t0 = now_sec(), t1;
+        do { k->add(a.data, b.data, r.data, len); ++reps; t1 = now_sec(); } while (t1 - t0 < 0.2);
+        double add_bw = 3.0 * len * sizeof(int) * reps / (t1 - t0) / 1e9;
+        long long check = r.data[len / 2];
+        reps = 0;
+        t0 = now_sec();
+        do { k->scale(a.data, r.data, len, 3); ++reps; t1 = now_sec(); } while (t1 - t0 < 0.2);
+        double scale_bw = 2.0 * len * sizeof(int) * reps / (t1 - t0) / 1e9;
+        check += r.data[len / 2];
+        printf("%-8s %12.2f %12.2f%s  (check %lld)\n", k->name, add_bw, scale_bw,
+               k == saved ? " *" : "", check);
+    }
+    matrix_free(&a); matrix_free(&b); matrix_free(&r);
+}
+
+/* Parallel GEMM on n x n inputs with 1..max_threads pool threads */
+void benchScaling(int n, int max_threads) {
+    struct Matrix a, b, ref, r;
+    matrix_init(&a); matrix_init(&b); matrix_init(&ref); matrix_init(&r);
+    matrix_require(&a, n, n);
+    matrix_require(&b, n, n);
+    randomFill(&a, 100);
+    randomFill(&b, 100);
+    double ops = 2.0 * n * n * n;
+    double base = 0;
+    printf("%8s %10s %9s %11s %8s\n", "threads", "GOP/s", "speedup", "efficiency", "check");
+    for (int t = 1; t <= max_threads; ++t) {
+        struct ThreadPool p;
+        if (pool_init(&p, t) != 0) {
+            printf("%8d could not start threads\n", t);
+            break;
+        }
+        int reps = 0;
+        double t0 = now_sec(), t1;
+        do {
+            multMatrixParallel(&p, &a, &b, &r);
+            ++reps;
+            t1 = now_sec();
+        } while (t1 - t0 < 0.2);
+        double gops = ops * reps / (t1 - t0) / 1e9;
+        if (t == 1) {
+            base = gops;
+            copyMatrix(&r, &ref);
+        }
+        printf("%8d %10.3f %8.2fx %10.0f%% %8s\n", t, gops, gops / base,
+               100.0 * gops / base / t, matrix_equal(&r, &ref) ? "ok" : "MISMATCH");
+        fflush(stdout);
+        pool_destroy(&p);
+    }
+    matrix_free(&a); matrix_free(&b); matrix_free(&ref); matrix_free(&r);
+}
+
+/* naive vs blocked vs in-place transpose of an n x n matrix, in GB/s of
+   elements read plus written */
+void benchTranspose(int n) {
+    struct Matrix a, r1, r2;
+    matrix_init(&a); matrix_init(&r1); matrix_init(&r2);
+    matrix_require(&a, n, n);
+    randomFill(&a, 1000);
+    double bytes = 2.0 * n * n * sizeof(int);
+    const char *names[3] = { "naive", "blocked", "in-place" };
+    for (int v = 0; v < 3; ++v) {
+        int reps = 0;
+        double t0 = now_sec(), t1;
+        do {
+            if (v == 0) transposeNaive(&a, &r1);
+            else if (v == 1) transpose(&a, &r2);
+            else transposeInPlace(&a); /* even rep count restores a */
+            ++reps;
+            t1 = now_sec();
+        } while (t1 - t0 < 0.2 || (v == 2 && reps % 2));
+        printf("%-9s %8.2f GB/s  %s\n", names[v], bytes * reps / (t1 - t0) / 1e9,
+               v == 1 ? (matrix_equal(&r1, &r2) ? "ok" : "MISMATCH") : "");
+    }
+    matrix_free(&a); matrix_free(&r1); matrix_free(&r2);
+}
+
+/* Tiled GEMM vs Strassen-Winograd at several crossovers, for each power
+   of two n from 256 up to max_n and its odd neighbours n - 1 and n + 1,
+   which take the peeling path. Both run on one thread. GOP/s is the
+   classic 2n^3 count for both, so a higher number for Strassen means it
+   finished sooner. */
+void benchStrassen(int max_n) {
+    static const int cutoffs[] = { 64, 128, 256, 512 };
+    const int ncut = (int)(sizeof(cutoffs) / sizeof(cutoffs[0]));
+    struct Matrix a, b, ref, r;
+    matrix_init(&a); matrix_init(&b); matrix_init(&ref); matrix_init(&r);
+    printf("%6s %10s", "n", "tiled");
+    for (int c = 0; c < ncut; ++c) printf("   sw@%-4d", cutoffs[c]);
+    printf("   (GOP/s)\n");
+    for (int i = 0; 256 << (i / 3) <= max_n; ++i) {
+        int n = (256 << (i / 3)) + i % 3 - 1;
+        matrix_require(&a, n, n);
+        matrix_require(&b, n, n);
+        randomFill(&a, 100);
+        randomFill(&b, 100);
+        double ops = 2.0 * n * n * n;
+        int reps = 0;
+        double t0 = now_sec(), t1;
+        do { multMatrixTiled(&a, &b, &ref); ++reps; t1 = now_sec(); } while (t1 - t0 < 0.2);
+        printf("%6d %10.3f", n, ops * reps / (t1 - t0) / 1e9);
+        int ok = 1;
+        for (int c = 0; c < ncut; ++c) {
+            reps = 0;
+            t0 = now_sec();
+            do {
+                multMatrixStrassen(&a, &b, &r, cutoffs[c]);
+                ++reps;
+                t1 = now_sec();
+            } while (t1 - t0 < 0.2);
+            printf(" %9.3f", ops * reps / (t1 - t0) / 1e9);
+            ok &= matrix_equal(&r, &ref);
+        }
+        printf("   %s\n", ok ? "ok" : "MISMATCH");
+        fflush(stdout);
+    }
+    matrix_free(&a); matrix_free(&b); matrix_free(&ref); matrix_free(&r);
+}
+
+/* Time every accumulator mode on n x n inputs filled from [-range, range]
+   and count entries that differ from the exact int64 result */
+void benchAccModes(int n, int range) {
+    struct Matrix a, b;
+    struct TMatrix exact, r;
+    matrix_init(&a); matrix_init(&b);
+    tmatrix_init(&exact); tmatrix_init(&r);
+    matrix_require(&a, n, n);
+    matrix_require(&b, n, n);
+    randomFill(&a, range);
+    randomFill(&b, range);
+    multMatrixAcc(&a, &b, ACC_INT64, &exact);
+    printf("%-14s %10s %12s\n", "mode", "GOP/s", "wrong cells");
+    for (int mode = 0; mode < ACC_MODES; ++mode) {
+        int reps = 0;
+        double t0 = now_sec(), t1;
+        do { multMatrixAcc(&a, &b, (enum AccMode)mode, &r); ++reps; t1 = now_sec(); } while (t1 - t0 < 0.2);
+        long long wrong = 0;
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+                wrong += tmatrix_get(&r, i, j) != (double)TMAT(&exact, int64_t, i, j);
+        printf("%-14s %10.3f %12lld\n", acc_mode_names[mode],
+               2.0 * n * n * n * reps / (t1 - t0) / 1e9, wrong);
+    }
+    matrix_free(&a); matrix_free(&b);
+    tmatrix_free(&exact); tmatrix_free(&r);
+}
+
+/* Sparse matrices.
+   CSR keeps row i's nonzeros at [ptr[i], ptr[i+1]) of idx (column) and val;
+   CSC is the same arrays by column, i.e. the CSR form of the transpose.
+   Indices within a row (column) are kept sorted, which sparse_add's merge
+   and the SpGEMM output rely on. Memory is O(rows + nnz) and every kernel
+   below is proportional to the nonzeros it touches, not to rows * cols. */
+enum SparseFormat { SP_CSR, SP_CSC };
+
+struct SparseMatrix {
+    int rows;
+    int cols;
+    int nnz;
+    enum SparseFormat format;
+    int *ptr;   /* rows + 1 (CSR) or cols + 1 (CSC) offsets */
+    int *idx;   /* column (CSR) or row (CSC) of each entry */
+    int *val;
+};
+
+void sparse_init(struct SparseMatrix *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+void sparse_free(struct SparseMatrix *s) {
+    free(s->ptr);
+    free(s->idx);
+    free(s->val);
+    sparse_init(s);
+}
+
+/* Allocate arrays for a rows x cols matrix with room for nnz entries */
+static void sparse_alloc(struct SparseMatrix *s, enum SparseFormat fmt, int rows, int cols, int nnz) {
+    int major = fmt == SP_CSR ? rows : cols;
+    sparse_free(s);
+    s->rows = rows;
+    s->cols = cols;
+    s->nnz = nnz;
+    s->format = fmt;
+    s->ptr = (int*)calloc((size_t)major + 1, sizeof(int));
+    s->idx = (int*)malloc(sizeof(int) * (size_t)(nnz ? nnz : 1));
+    s->val = (int*)malloc(sizeof(int) * (size_t)(nnz ? nnz : 1));
+    if (!s->ptr || !s->idx || !s->val) { perror("malloc"); exit(1); }
+}
+
+/* Dense -> sparse, keeping only nonzero entries */
+void sparse_from_dense(const struct Matrix *a, enum SparseFormat fmt, struct SparseMatrix *s) {
+    int nnz = 0;
+    for (int i = 0; i < a->rows; ++i)
+        for (int j = 0; j < a->cols; ++j)
+            nnz += MAT(a, i, j) != 0;
+    sparse_alloc(s, fmt, a->rows, a->cols, nnz);
+    int major = fmt == SP_CSR ? a->rows : a->cols;
+    int minor = fmt == SP_CSR ? a->cols : a->rows;
+    int k = 0;
+    for (int p = 0; p < major; ++p) {
+        for (int q = 0; q < minor; ++q) {
+            int v = fmt == SP_CSR ? MAT(a, p, q) : MAT(a, q, p);
+            if (v == 0) continue;
+            s->idx[k] = q;
+            s->val[k] = v;
+            ++k;
+        }
+        s->ptr[p + 1] = k;
+    }
+}
+
+/* Sparse -> dense; returns -1 if the matrix is too large for struct Matrix */
+int sparse_to_dense(const struct SparseMatrix *s, struct Matrix *a) {
+    if (matrix_resize(a, s->rows, s->cols) != 0) return -1;
+    int major = s->format == SP_CSR ? s->rows : s->cols;
+    for (int p = 0; p < major; ++p)
+        for (int k = s->ptr[p]; k < s->ptr[p + 1]; ++k) {
+            if (s->format == SP_CSR) MAT(a, p, s->idx[k]) = s->val[k];
+            else MAT(a, s->idx[k], p) = s->val[k];
+        }
+    return 0;
+}
+
+/* Re-index the same entries by the other dimension (counting sort, one
+   pass over nnz). With keep_format the result is the transpose in s's own
+   format; otherwise it is s itself converted CSR <-> CSC. */
+static void sparse_flip(const struct SparseMatrix *s, struct SparseMatrix *out, int keep_format) {
+    int major = s->format == SP_CSR ? s->rows : s->cols;
+    int minor = s->format == SP_CSR ? s->cols : s->rows;
+    struct SparseMatrix t;
+    sparse_init(&t);
+    if (keep_format)
+        sparse_alloc(&t, s->format, s->cols, s->rows, s->nnz);
+    else
+        sparse_alloc(&t, s->format == SP_CSR ? SP_CSC : SP_CSR, s->rows, s->cols, s->nnz);
+    for (int k = 0; k < s->nnz; ++k) t.ptr[s->idx[k] + 1]++;
+    for (int q = 0; q < minor; ++q) t.ptr[q + 1] += t.ptr[q];
+    int *next = (int*)malloc(sizeof(int) * (size_t)(minor ? minor : 1));
+    if (!next) { perror("malloc"); exit(1); }
+    memcpy(next, t.ptr, sizeof(int) * (size_t)minor);
+    /* walking majors in order leaves each output segment sorted */
+    for (int p = 0; p < major; ++p)
+        for (int k = s->ptr[p]; k < s->ptr[p + 1]; ++k) {
+            int dst = next[s->idx[k]]++;
+            t.idx[dst] = p;
+            t.val[dst] = s->val[k];
+        }
+    free(next);
+    sparse_free(out);
+    *out = t;
+}
+
+/* out = s^T, same format as s; out must not be s */
+void sparse_transpose(const struct SparseMatrix *s, struct SparseMatrix *out) {
+    sparse_flip(s, out, 1);
+}
+
+/* out = s in the other format (CSR <-> CSC); out must not be s */
+void sparse_convert(const struct SparseMatrix *s, struct SparseMatrix *out) {
+    sparse_flip(s, out, 0);
+}
+
+/* y = s * x (SpMV). CSR gathers one dot product per row; CSC scatters
+   each column's entries into y. y has s->rows entries. */
+void sparse_spmv(const struct SparseMatrix *s, const int *x, int *y) {
+    if (s->format == SP_CSR) {
+        for (int i = 0; i < s->rows; ++i) {
+            int sum = 0;
+            for (int k = s->ptr[i]; k < s->ptr[i + 1]; ++k) sum += s->val[k] * x[s->idx[k]];
+            y[i] = sum;
+        }
+    } else {
+        memset(y, 0, sizeof(int) * (size_t)s->rows);
+        for (int j = 0; j < s->cols; ++j) {
+            int xj = x[j];
+            if (xj == 0) continue;
+            for (int k = s->ptr[j]; k < s->ptr[j + 1]; ++k) y[s->idx[k]] += s->val[k] * xj;
+        }
+    }
+}
+
+/* res = s * b, sparse times dense (SpMM). Each nonzero s(i,k) adds
+   s(i,k) * row k of b to row i of res; for CSC the roles flip to
+   column k of s. Cost is nnz(s) * b->cols. */
+void sparse_spmm(const struct SparseMatrix *s, const struct Matrix *b, struct Matrix *res) {
+    if (res == b) {
+        struct Matrix t;
+        matrix_init(&t);
+        sparse_spmm(s, b, &t);
+        matrix_replace(res, &t);
+        return;
+    }
+    matrix_require(res, s->rows, b->cols);
+    int major = s->format == SP_CSR ? s->rows : s->cols;
+    for (int p = 0; p < major; ++p) {
+        for (int k = s->ptr[p]; k < s->ptr[p + 1]; ++k) {
+            int i = s->format == SP_CSR ? p : s->idx[k];
+            int kk = s->format == SP_CSR ? s->idx[k] : p;
+            int v = s->val[k];
+            const int *br = &MAT(b, kk, 0);
+            int *cr = &MAT(res, i, 0);
+            for (int j = 0; j < b->cols; ++j) cr[j] += v * br[j];
+        }
+    }
+}
+
+static int cmp_int(const void *x, const void *y) {
+    int a = *(const int*)x, b = *(const int*)y;
+    return (a > b) - (a < b);
+}
+
+/* out = a * b for CSR a and b (SpGEMM), Gustavson's row-by-row method
+   with a dense marker per output column. A symbolic pass sizes each
+   output row so the numeric pass writes straight into the final arrays.
+   Entries that cancel to zero are kept as explicit zeros. Returns 0, or
+   -1 (out untouched) if the result would exceed INT_MAX nonzeros. */
+int sparse_spgemm(const struct SparseMatrix *a, const struct SparseMatrix *b,
+                   struct SparseMatrix *out) {
+    int n = b->cols;
+    int *mark = (int*)malloc(sizeof(int) * (size_t)(n ? n : 1));
+    int *acc = (int*)calloc((size_t)(n ? n : 1), sizeof(int));
+    int *ptr = (int*)calloc((size_t)a->rows + 1, sizeof(int));
+    if (!mark || !acc || !ptr) { perror("malloc"); exit(1); }
+    for (int j = 0; j < n; ++j) mark[j] = -1;
+
+    long long total = 0;
+    for (int i = 0; i < a->rows; ++i) {
+        int cnt = 0;
+        for (int ka = a->ptr[i]; ka < a->ptr[i + 1]; ++ka) {
+            int k = a->idx[ka];
+            for (int kb = b->ptr[k]; kb < b->ptr[k + 1]; ++kb)
+                if (mark[b->idx[kb]] != i) { mark[b->idx[kb]] = i; ++cnt; }
+        }
+        total += cnt;
+        if (total > INT_MAX) {
+            free(mark);
+            free(acc);
+            free(ptr);
+            return -1;
+        }
+        ptr[i + 1] = (int)total;
+    }
+
+    struct SparseMatrix c;
+    sparse_init(&c);
+    sparse_alloc(&c, SP_CSR, a->rows, n, (int)total);
+    memcpy(c.ptr, ptr, sizeof(int) * ((size_t)a->rows + 1));
+    for (int j = 0; j < n; ++j) mark[j] = -1;
+    for (int i = 0; i < a->rows; ++i) {
+        int *cols = c.idx + c.ptr[i];
+        int cnt = 0;
+        for (int ka = a->ptr[i]; ka < a->ptr[i + 1]; ++ka) {
+            int k = a->idx[ka], av = a->val[ka];
+            for (int kb = b->ptr[k]; kb < b->ptr[k + 1]; ++kb) {
+                int j = b->idx[kb];
+                if (mark[j] != i) { mark[j] = i; cols[cnt++] = j; acc[j] = 0; }
+                acc[j] += av * b->val[kb];
+            }
+        }
+        qsort(cols, (size_t)cnt, sizeof(int), cmp_int);
+        for (int t = 0; t < cnt; ++t) c.val[c.ptr[i] + t] = acc[cols[t]];
+    }
+    free(mark);
+    free(acc);
+    free(ptr);
+    sparse_free(out);
+    *out = c;
     return 0;
 }
 
-/* Load matrix from file */
-int loadMatrixFromFile(const char *fname, int a[MAX][MAX], int *r, int *c) {
+/* out = a + b for same-shaped CSR matrices: merge of each row's sorted
+   column lists; entries that sum to zero are dropped. */
+void sparse_add(const struct SparseMatrix *a, const struct SparseMatrix *b, struct SparseMatrix *out) {
+    struct SparseMatrix c;
+    sparse_init(&c);
+    sparse_alloc(&c, SP_CSR, a->rows, a->cols, a->nnz + b->nnz);
+    int k = 0;
+    for (int i = 0; i < a->rows; ++i) {
+        int pa = a->ptr[i], ea = a->ptr[i + 1];
+        int pb = b->ptr[i], eb = b->ptr[i + 1];
+        while (pa < ea || pb < eb) {
+            int j, v;
+            if (pb >= eb || (pa < ea && a->idx[pa] < b->idx[pb])) {
+                j = a->idx[pa]; v = a->val[pa++];
+            } else if (pa >= ea || b->idx[pb] < a->idx[pa]) {
+                j = b->idx[pb]; v = b->val[pb++];
+            } else {
+                j = a->idx[pa]; v = a->val[pa++] + b->val[pb++];
+            }
+            if (v == 0) continue;
+            c.idx[k] = j;
+            c.val[k] = v;
+            ++k;
+        }
+        c.ptr[i + 1] = k;
+    }
+    c.nnz = k;
+    sparse_free(out);
+    *out = c;
+}
+
+/* One coordinate entry while building from a Matrix Market file */
+struct CooEntry {
+    int row;
+    int col;
+    int val;
+};
+
+static int cmp_coo(const void *x, const void *y) {
+    const struct CooEntry *a = (const struct CooEntry*)x, *b = (const struct CooEntry*)y;
+    if (a->row != b->row) return (a->row > b->row) - (a->row < b->row);
+    return (a->col > b->col) - (a->col < b->col);
+}
+
+/* Sort coordinates and build CSR; duplicate coordinates are summed and,
+   as in sparse_add, entries that come out zero are dropped */
+static void sparse_from_coo(struct CooEntry *e, int n, int rows, int cols, struct SparseMatrix *s) {
+    qsort(e, (size_t)n, sizeof(*e), cmp_coo);
+    int u = 0;
+    for (int k = 0; k < n; ++k) {
+        if (u > 0 && e[u - 1].row == e[k].row && e[u - 1].col == e[k].col) {
+            e[u - 1].val += e[k].val;
+        } else {
+            if (u > 0 && e[u - 1].val == 0) --u;
+            e[u++] = e[k];
+        }
+    }
+    if (u > 0 && e[u - 1].val == 0) --u;
+    sparse_alloc(s, SP_CSR, rows, cols, u);
+    for (int k = 0; k < u; ++k) {
+        s->ptr[e[k].row + 1]++;
+        s->idx[k] = e[k].col;
+        s->val[k] = e[k].val;
+    }
+    for (int i = 0; i < rows; ++i) s->ptr[i + 1] += s->ptr[i];
+}
+
+/* Load a Matrix Market coordinate file into CSR.
+   Supports integer, real (rounded to the nearest int) and pattern (all
+   ones) fields with general, symmetric or skew-symmetric symmetry; the
+   banner keywords are matched without regard to case. Explicit zeros are
+   not stored. Returns 0, -1 (open), -2 (bad header), -3 (bad size line),
+   -4 (bad entry, including values outside the int range) or -5
+   (array/complex/hermitian, not supported). */
+int loadMatrixMarket(const char *fname, struct SparseMatrix *s) {
+    char line[1024], object[32], format[32], field[32], symmetry[32];
     FILE *fp = fopen(fname, "r");
     if (!fp) return -1;
-    if (fscanf(fp, "%d %d", r, c) != 2) {
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, "%%%%MatrixMarket %31s %31s %31s %31s", object, format, field, symmetry) != 4 ||
+        strcasecmp(object, "matrix") != 0) {
         fclose(fp);
         return -2;
     }
-    if (*r < 0 || *r > MAX || *c < 0 || *c > MAX) {
+    int is_real = strcasecmp(field, "real") == 0 || strcasecmp(field, "double") == 0;
+    int is_pattern = strcasecmp(field, "pattern") == 0;
+    int sym = strcasecmp(symmetry, "symmetric") == 0 ? 1 : (strcasecmp(symmetry, "skew-symmetric") == 0 ? -1 : 0);
+    if (strcasecmp(format, "coordinate") != 0 || (!is_real && !is_pattern && strcasecmp(field, "integer") != 0) ||
+        (!sym && strcasecmp(symmetry, "general") != 0)) {
+        fclose(fp);
+        return -5;
+    }
+    do {
+        if (!fgets(line, sizeof(line), fp)) { fclose(fp); return -3; }
+    } while (line[0] == '%' || strspn(line, " \t\r\n") == strlen(line));
+    long long rows, cols, entries;
+    if (sscanf(line, "%lld %lld %lld", &rows, &cols, &entries) != 3 ||
+        rows < 0 || cols < 0 || entries < 0 || rows > INT_MAX - 1 || cols > INT_MAX - 1 ||
+        entries > INT_MAX / 2) {
         fclose(fp);
         return -3;
     }
-    for (int i = 0; i < *r; ++i) {
-        for (int j = 0; j < *c; ++j) {
-            if (fscanf(fp, "%d", &a[i][j]) != 1) {
-                fclose(fp);
-                return -4;
-            }
+    size_t cap = (size_t)entries * (sym ? 2 : 1);
+    struct CooEntry *e = (struct CooEntry*)malloc(sizeof(*e) * (cap ? cap : 1));
+    if (!e) { perror("malloc"); exit(1); }
+    int n = 0;
+    for (long long t = 0; t < entries; ++t) {
+        long long r, c;
+        double v = 1.0;
+        int got = is_pattern ? fscanf(fp, "%lld %lld", &r, &c) : fscanf(fp, "%lld %lld %lf", &r, &c, &v);
+        /* rounds into int; also false for NaN, and -INT_MIN would overflow */
+        int fits = v > INT_MIN - 0.5 && v < INT_MAX + 0.5 && !(sym < 0 && v < INT_MIN + 0.5);
+        if (got != (is_pattern ? 2 : 3) || r < 1 || r > rows || c < 1 || c > cols || !fits) {
+            free(e);
+            fclose(fp);
+            return -4;
+        }
+        int iv = (int)(v < 0 ? v - 0.5 : v + 0.5);
+        e[n].row = (int)r - 1;
+        e[n].col = (int)c - 1;
+        e[n].val = iv;
+        ++n;
+        if (sym && r != c) {
+            e[n].row = (int)c - 1;
+            e[n].col = (int)r - 1;
+            e[n].val = sym * iv;
+            ++n;
         }
     }
     fclose(fp);
+    sparse_from_coo(e, n, (int)rows, (int)cols, s);
+    free(e);
     return 0;
 }
 
-/* Addition and subtraction */
-void addMatrix(int a[MAX][MAX], int b[MAX][MAX], int res[MAX][MAX], int r, int c) {
-    for (int i = 0; i < r; ++i)
-        for (int j = 0; j < c; ++j)
-            res[i][j] = a[i][j] + b[i][j];
-}
-
-void subMatrix(int a[MAX][MAX], int b[MAX][MAX], int res[MAX][MAX], int r, int c) {
-    for (int i = 0; i < r; ++i)
-        for (int j = 0; j < c; ++j)
-            res[i][j] = a[i][j] - b[i][j];
+/* Write s as a general integer coordinate Matrix Market file */
+int saveMatrixMarket(const char *fname, const struct SparseMatrix *s) {
+    FILE *fp = fopen(fname, "w");
+    if (!fp) return -1;
+    fprintf(fp, "%%%%MatrixMarket matrix coordinate integer general\n");
+    fprintf(fp, "%d %d %d\n", s->rows, s->cols, s->nnz);
+    int major = s->format == SP_CSR ? s->rows : s->cols;
+    for (int p = 0; p < major; ++p)
+        for (int k = s->ptr[p]; k < s->ptr[p + 1]; ++k) {
+            if (s->format == SP_CSR) fprintf(fp, "%d %d %d\n", p + 1, s->idx[k] + 1, s->val[k]);
+            else fprintf(fp, "%d %d %d\n", s->idx[k] + 1, p + 1, s->val[k]);
+        }
+    fclose(fp);
+    return 0;
 }
 
-/* Multiply a (r1 x c1) by b (c1 x c2) into result (r1 x c2) */
-void multMatrix(int a[MAX][MAX], int b[MAX][MAX], int res[MAX][MAX], int r1, int c1, int c2) {
-    for (int i = 0; i < r1; ++i) {
-        for (int j = 0; j < c2; ++j) {
-            res[i][j] = 0;
-            for (int k = 0; k < c1; ++k) {
-                res[i][j] += a[i][k] * b[k][j];
-            }
+/* Random rows x cols CSR matrix with about density * cols nonzeros per
+   row, values in [-range, range] excluding 0 */
+void sparse_random(int rows, int cols, double density, int range, struct SparseMatrix *s) {
+    int per_row = (int)(density * cols + 0.5);
+    if (per_row > cols) per_row = cols;
+    if (range < 1) range = 1;
+    sparse_alloc(s, SP_CSR, rows, cols, 0);
+    long long cap = (long long)rows * per_row;
+    if (cap > INT_MAX) { fprintf(stderr, "too many nonzeros\n"); exit(1); }
+    free(s->idx);
+    free(s->val);
+    s->idx = (int*)malloc(sizeof(int) * (size_t)(cap ? cap : 1));
+    s->val = (int*)malloc(sizeof(int) * (size_t)(cap ? cap : 1));
+    if (!s->idx || !s->val) { perror("malloc"); exit(1); }
+    int k = 0;
+    for (int i = 0; i < rows; ++i) {
+        int *cols_i = s->idx + k;
+        for (int t = 0; t < per_row; ++t) cols_i[t] = rand() % cols;
+        qsort(cols_i, (size_t)per_row, sizeof(int), cmp_int);
+        int u = 0;
+        for (int t = 0; t < per_row; ++t)
+            if (u == 0 || cols_i[u - 1] != cols_i[t]) cols_i[u++] = cols_i[t];
+        for (int t = 0; t < u; ++t) {
+            int v = rand() % (2 * range + 1) - range;
+            s->val[k + t] = v ? v : 1;
         }
+        k += u;
+        s->ptr[i + 1] = k;
     }
+    s->nnz = k;
 }
 
-/* Scalar multiply */
-void scalarMultiply(int a[MAX][MAX], int res[MAX][MAX], int r, int c, int scalar) {
-    for (int i = 0; i < r; ++i)
-        for (int j = 0; j < c; ++j)
-            res[i][j] = a[i][j] * scalar;
+/* Shape, nnz, density and storage compared with a dense int matrix */
+void sparse_info(const struct SparseMatrix *s) {
+    double cells = (double)s->rows * s->cols;
+    int major = s->format == SP_CSR ? s->rows : s->cols;
+    double bytes = sizeof(int) * ((double)major + 1 + 2.0 * s->nnz);
+    printf("%s %d x %d, nnz %d, density %.4f%%, %.1f KiB (dense would be %.1f KiB)\n",
+           s->format == SP_CSR ? "CSR" : "CSC", s->rows, s->cols, s->nnz,
+           cells > 0 ? 100.0 * s->nnz / cells : 0.0, bytes / 1024, cells * sizeof(int) / 1024);
 }
 
-/* Transpose (r x c -> c x r) */
-void transpose(int a[MAX][MAX], int res[MAX][MAX], int r, int c) {
-    for (int i = 0; i < r; ++i)
-        for (int j = 0; j < c; ++j)
-            res[j][i] = a[i][j];
-}
+/* SpMV and SpGEMM against their dense counterparts on n x n matrices of
+   the given density */
+void benchSparse(int n, double density) {
+    struct SparseMatrix s, p;
+    struct Matrix d, r1, r2;
+    sparse_init(&s); sparse_init(&p);
+    matrix_init(&d); matrix_init(&r1); matrix_init(&r2);
+    sparse_random(n, n, density, 9, &s);
+    sparse_info(&s);
+    int dense_ok = sparse_to_dense(&s, &d) == 0;
+    int *x = (int*)malloc(sizeof(int) * (size_t)n);
+    int *y = (int*)malloc(sizeof(int) * (size_t)n);
+    if (!x || !y) { perror("malloc"); exit(1); }
+    for (int i = 0; i < n; ++i) x[i] = rand() % 19 - 9;
 
-/* Helper: copy matrix */
-void copyMatrix(int src[MAX][MAX], int dst[MAX][MAX], int r, int c) {
-    for (int i = 0; i < r; ++i)
-        for (int j = 0; j < c; ++j)
-            dst[i][j] = src[i][j];
-}
+    int reps = 0;
+    double t0 = now_sec(), t1;
+    do { sparse_spmv(&s, x, y); ++reps; t1 = now_sec(); } while (t1 - t0 < 0.2);
+    printf("SpMV   CSR        %10.3f ms\n", (t1 - t0) * 1e3 / reps);
+    if (dense_ok) {
+        long long check = 0;
+        reps = 0;
+        t0 = now_sec();
+        do {
+            for (int i = 0; i < n; ++i) {
+                int sum = 0;
+                const int *row = &MAT(&d, i, 0);
+                for (int j = 0; j < n; ++j) sum += row[j] * x[j];
+                check += sum;
+            }
+            ++reps;
+            t1 = now_sec();
+        } while (t1 - t0 < 0.2);
+        printf("MatVec dense      %10.3f ms  (check %lld)\n", (t1 - t0) * 1e3 / reps, check);
+    }
 
-/* Determinant: compute recursively using expansion by minors.
-   Not optimized; works for small n (<=8 realistically). */
-int determinant_recursive(int mat[MAX][MAX], int n) {
-    if (n == 1) {
-        return mat[0][0];
+    t0 = now_sec();
+    int spgemm_ok = sparse_spgemm(&s, &s, &p) == 0;
+    t1 = now_sec();
+    if (spgemm_ok)
+        printf("SpGEMM CSR        %10.3f ms  (nnz out %d)\n", (t1 - t0) * 1e3, p.nnz);
+    else
+        printf("SpGEMM CSR        result exceeds INT_MAX nonzeros\n");
+    if (spgemm_ok && dense_ok && n <= 2048) {
+        t0 = now_sec();
+        multMatrix(&d, &d, &r1);
+        t1 = now_sec();
+        int ok = sparse_to_dense(&p, &r2) == 0 && matrix_equal(&r1, &r2);
+        printf("GEMM   dense      %10.3f ms  %s\n", (t1 - t0) * 1e3, ok ? "ok" : "MISMATCH");
     }
-    if (n == 2) {
-        return mat[0][0]*mat[1][1] - mat[0][1]*mat[1][0];
+    free(x);
+    free(y);
+    sparse_free(&s); sparse_free(&p);
+    matrix_free(&d); matrix_free(&r1); matrix_free(&r2);
+}
+
+/* fprintf/fscanf text I/O against the fast writer and the serial and
+   pooled fast readers, on an n x n random matrix written to fname */
+void benchTextIO(int n, const char *fname) {
+    struct Matrix a, b;
+    matrix_init(&a); matrix_init(&b);
+    matrix_require(&a, n, n);
+    randomFill(&a, 1000000);
+    double t0 = now_sec();
+    int ok = saveMatrixToFile(fname, &a) == 0;
+    double t1 = now_sec();
+    ok = ok && saveMatrixText(fname, &a) == 0;
+    double t2 = now_sec();
+    if (!ok) {
+        printf("Could not write %s\n", fname);
+        matrix_free(&a);
+        return;
     }
-    int det = 0;
-    int temp[MAX][MAX];
-    for (int p = 0; p < n; p++) {
-        int subi = 0;
-        for (int i = 1; i < n; i++) {
-            int subj = 0;
-            for (int j = 0; j < n; j++) {
-                if (j == p) continue;
-                temp[subi][subj] = mat[i][j];
-                subj++;
-            }
-            subi++;
-        }
-        int sign = (p % 2 == 0) ? 1 : -1;
-        det += sign * mat[0][p] * determinant_recursive(temp, n-1);
+    printf("write  fprintf      %8.3f s\n", t1 - t0);
+    printf("write  fast         %8.3f s\n", t2 - t1);
+    const char *names[3] = { "fscanf", "fast", "fast pooled" };
+    for (int v = 0; v < 3; ++v) {
+        t0 = now_sec();
+        int ret = v == 0 ? loadMatrixFromFile(fname, &b)
+                         : loadMatrixText(fname, &b, v == 2 ? &mat_pool : NULL);
+        t1 = now_sec();
+        printf("read   %-12s %8.3f s  %s\n", names[v], t1 - t0,
+               ret == 0 && matrix_equal(&a, &b) ? "ok" : "MISMATCH");
     }
-    return det;
+    printf("(pool has %d thread%s)\n", mat_pool.nthreads, mat_pool.nthreads == 1 ? "" : "s");
+    matrix_free(&a); matrix_free(&b);
 }
 
 /* Pretty header for menu */
@@ -179,15 +3063,147 @@ int dims_equal(int r1, int c1, int r2, int c2) {
     return r1 == r2 && c1 == c2;
 }
 
+/* Prompt for dimensions of a matrix and allocate it; 0 on success */
+int read_dims(const char *name, struct Matrix *m) {
+    char prompt[64];
+    snprintf(prompt, sizeof(prompt), "Enter rows for matrix %s (1..%d): ", name, MAX_DIM);
+    int r = safe_int_read(prompt);
+    snprintf(prompt, sizeof(prompt), "Enter cols for matrix %s (1..%d): ", name, MAX_DIM);
+    int c = safe_int_read(prompt);
+    if (r <= 0 || c <= 0 || matrix_resize(m, r, c) != 0) return -1;
+    return 0;
+}
+
+/* Sparse tools: S and T are sparse operands, A and B the dense ones */
+void sparse_menu(struct Matrix *A, struct Matrix *B, struct Matrix *R) {
+    struct SparseMatrix S, T, U;
+    char fname[FNAME_SZ];
+    sparse_init(&S);
+    sparse_init(&T);
+    sparse_init(&U);
+    while (1) {
+        printHeader("Sparse Matrices");
+        printf("S: ");
+        if (S.ptr) sparse_info(&S); else printf("empty\n");
+        printf("T: ");
+        if (T.ptr) sparse_info(&T); else printf("empty\n");
+        printf("1. Load S from Matrix Market (.mtx) file\n");
+        printf("2. Load T from Matrix Market (.mtx) file\n");
+        printf("3. S = sparse(A), T = sparse(B)\n");
+        printf("4. Convert S between CSR and CSC\n");
+        printf("5. SpMV: S * x (x = 1..cols)\n");
+        printf("6. SpMM: S * B (dense)\n");
+        printf("7. SpGEMM: S * T\n");
+        printf("8. S + T\n");
+        printf("9. S = transpose(S)\n");
+        printf("10. Save S to Matrix Market file\n");
+        printf("11. Copy S into dense A\n");
+        printf("12. Sparse vs dense benchmark\n");
+        printf("13. Back\n");
+        int c = safe_int_read("Enter choice: ");
+        if (c == 1 || c == 2) {
+            printf("Enter file name: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error.\n"); continue; }
+            int ret = loadMatrixMarket(fname, c == 1 ? &S : &T);
+            if (ret != 0) printf("Failed to load %s (err=%d)\n", fname, ret);
+        } else if (c == 3) {
+            sparse_from_dense(A, SP_CSR, &S);
+            sparse_from_dense(B, SP_CSR, &T);
+        } else if (c == 4) {
+            sparse_convert(&S, &U);
+            sparse_free(&S);
+            S = U;
+            sparse_init(&U);
+        } else if (c == 5) {
+            int *x = (int*)malloc(sizeof(int) * (size_t)(S.cols ? S.cols : 1));
+            int *y = (int*)malloc(sizeof(int) * (size_t)(S.rows ? S.rows : 1));
+            if (!x || !y) { perror("malloc"); exit(1); }
+            for (int j = 0; j < S.cols; ++j) x[j] = j + 1;
+            sparse_spmv(&S, x, y);
+            printf("y =");
+            for (int i = 0; i < S.rows && i < PRINT_MAX; ++i) printf(" %d", y[i]);
+            printf("%s\n", S.rows > PRINT_MAX ? " ..." : "");
+            free(x);
+            free(y);
+        } else if (c == 6) {
+            if (S.cols != B->rows) {
+                printf("S cols (%d) must equal B rows (%d).\n", S.cols, B->rows);
+            } else if (S.rows > MAX_DIM) {
+                printf("Result would exceed %d rows.\n", MAX_DIM);
+            } else {
+                sparse_spmm(&S, B, R);
+                printf("Result (S*B):\n");
+                printMatrix(R);
+            }
+        } else if (c == 7 || c == 8) {
+            if (S.format != SP_CSR || T.format != SP_CSR) {
+                printf("S and T must both be CSR.\n");
+            } else if (c == 7 && S.cols != T.rows) {
+                printf("S cols (%d) must equal T rows (%d).\n", S.cols, T.rows);
+            } else if (c == 8 && (S.rows != T.rows || S.cols != T.cols)) {
+                printf("S and T must have the same dimensions.\n");
+            } else {
+                if (c == 7 && sparse_spgemm(&S, &T, &U) != 0) {
+                    printf("Product has too many nonzeros.\n");
+                    continue;
+                }
+                if (c == 8) sparse_add(&S, &T, &U);
+                printf("Result: ");
+                sparse_info(&U);
+                sparse_free(&S);
+                S = U;
+                sparse_init(&U);
+                printf("Stored in S.\n");
+            }
+        } else if (c == 9) {
+            sparse_transpose(&S, &U);
+            sparse_free(&S);
+            S = U;
+            sparse_init(&U);
+        } else if (c == 10) {
+            printf("Enter file name: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error.\n"); continue; }
+            if (saveMatrixMarket(fname, &S) == 0) printf("Saved successfully.\n");
+            else printf("Failed to save.\n");
+        } else if (c == 11) {
+            if (sparse_to_dense(&S, A) != 0) printf("S is too large for a dense matrix.\n");
+            else printf("A is now %d x %d.\n", A->rows, A->cols);
+        } else if (c == 12) {
+            int n = safe_int_read("Size n (n x n): ");
+            int per_mille = safe_int_read("Density in nonzeros per 1000: ");
+            if (n > 0 && n <= 1000000 && per_mille > 0 && per_mille <= 1000)
+                benchSparse(n, per_mille / 1000.0);
+            else
+                printf("Invalid input.\n");
+        } else if (c == 13) {
+            break;
+        } else {
+            printf("Invalid option. Try again.\n");
+        }
+    }
+    sparse_free(&S);
+    sparse_free(&T);
+    sparse_free(&U);
+}
+
 /* Main menu for the matrix program */
 int main(void) {
-    int A[MAX][MAX] = {0}, B[MAX][MAX] = {0}, R[MAX][MAX] = {0};
-    int r1 = 0, c1 = 0, r2 = 0, c2 = 0;
+    struct Matrix A, B, R;
+    struct TMatrix T;   /* result of typed (non-int32) products */
+    enum AccMode acc_mode = ACC_INT32;
     int choice;
     char fname[FNAME_SZ];
     srand((unsigned)time(NULL));
+    simd_init();
+    if (pool_init(&mat_pool, default_threads()) != 0)
+        fprintf(stderr, "could not start worker threads; multiplying on one core\n");
+    matrix_init(&A);
+    matrix_init(&B);
+    matrix_init(&R);
+    tmatrix_init(&T);
 
     printHeader("Matrix Operations - Extended");
+    printf("Elementwise kernels: %s, multiply threads: %d\n", elem->name, mat_pool.nthreads);
 
     /* Ask user to choose whether to load or input matrices */
     while (1) {
@@ -198,48 +3214,45 @@ int main(void) {
         printf("4. Exit program\n");
         int init_choice = safe_int_read("Choice: ");
         if (init_choice == 1) {
-            r1 = safe_int_read("Enter rows for matrix A (1..10): ");
-            c1 = safe_int_read("Enter cols for matrix A (1..10): ");
-            if (r1 <= 0 || r1 > MAX || c1 <= 0 || c1 > MAX) {
+            if (read_dims("A", &A) != 0) {
                 printf("Invalid dimensions. Try again.\n");
                 continue;
             }
             printf("Enter Matrix A:\n");
-            readMatrix(A, r1, c1);
+            readMatrix(&A);
 
-            r2 = safe_int_read("Enter rows for matrix B (1..10): ");
-            c2 = safe_int_read("Enter cols for matrix B (1..10): ");
-            if (r2 <= 0 || r2 > MAX || c2 <= 0 || c2 > MAX) {
+            if (read_dims("B", &B) != 0) {
                 printf("Invalid dimensions for B. Try again.\n");
                 continue;
             }
             printf("Enter Matrix B:\n");
-            readMatrix(B, r2, c2);
+            readMatrix(&B);
             break;
         } else if (init_choice == 2) {
-            r1 = safe_int_read("Enter rows for matrix A (1..10): ");
-            c1 = safe_int_read("Enter cols for matrix A (1..10): ");
-            r2 = safe_int_read("Enter rows for matrix B (1..10): ");
-            c2 = safe_int_read("Enter cols for matrix B (1..10): ");
+            if (read_dims("A", &A) != 0 || read_dims("B", &B) != 0) {
+                printf("Invalid dimensions. Try again.\n");
+                continue;
+            }
             int rng = safe_int_read("Enter random range (positive integer): ");
             if (rng < 0) rng = 10;
-            randomFill(A, r1, c1, rng);
-            randomFill(B, r2, c2, rng);
+            randomFill(&A, rng);
+            randomFill(&B, rng);
             printf("Matrices random-filled.\n");
             break;
         } else if (init_choice == 3) {
             printf("Enter file name for matrix A: ");
             if (scanf("%127s", fname) != 1) { printf("Read error.\n"); continue; }
-            int ret = loadMatrixFromFile(fname, A, &r1, &c1);
+            int ret = loadMatrixText(fname, &A, &mat_pool);
             if (ret != 0) { printf("Failed to load A from %s (err=%d)\n", fname, ret); continue; }
             printf("Enter file name for matrix B: ");
             if (scanf("%127s", fname) != 1) { printf("Read error.\n"); continue; }
-            ret = loadMatrixFromFile(fname, B, &r2, &c2);
+            ret = loadMatrixText(fname, &B, &mat_pool);
             if (ret != 0) { printf("Failed to load B from %s (err=%d)\n", fname, ret); continue; }
-            printf("Loaded A (%d x %d) and B (%d x %d)\n", r1, c1, r2, c2);
+            printf("Loaded A (%d x %d) and B (%d x %d)\n", A.rows, A.cols, B.rows, B.cols);
             break;
         } else if (init_choice == 4) {
             printf("Goodbye.\n");
+            pool_destroy(&mat_pool);
             return 0;
         } else {
             printf("Try again.\n");
@@ -249,7 +3262,7 @@ int main(void) {
     /* Main operation loop */
     while (1) {
         printHeader("Main Menu");
-        printf("A: dims A = %d x %d | B: dims B = %d x %d\n", r1, c1, r2, c2);
+        printf("A: dims A = %d x %d | B: dims B = %d x %d\n", A.rows, A.cols, B.rows, B.cols);
         printf("1. Print matrices\n");
         printf("2. Add (A+B)\n");
         printf("3. Subtract (A-B)\n");
@@ -262,57 +3275,85 @@ int main(void) {
         printf("10. Swap A and B\n");
         printf("11. Re-enter matrices\n");
         printf("12. Exit\n");
+        printf("13. Benchmark multiply (A*B)\n");
+        printf("14. GEMM sweep: naive vs tiled, 64..N\n");
+        printf("15. Elementwise SIMD benchmark\n");
+        printf("16. Set multiply thread count (now %d)\n", mat_pool.nthreads);
+        printf("17. Thread scaling benchmark\n");
+        printf("18. Transpose A in place\n");
+        printf("19. Transpose benchmark\n");
+        printf("20. Strassen settings (%s, crossover %d; single-threaded)\n",
+               strassen_enabled ? "on" : "off", strassen_crossover);
+        printf("21. Strassen benchmark (single-threaded)\n");
+        printf("22. Multiply accumulator mode (now %s)\n", acc_mode_names[acc_mode]);
+        printf("23. Accumulator mode benchmark\n");
+        printf("24. Sparse matrices (CSR/CSC)\n");
+        printf("25. Save a matrix to binary file\n");
+        printf("26. Load binary file (mmap) into A or B\n");
+        printf("27. Convert text matrix file to binary\n");
+        printf("28. Text I/O benchmark\n");
+        printf("29. Create random binary matrix file\n");
+        printf("30. Out-of-core multiply of binary files\n");
 
         choice = safe_int_read("Enter choice: ");
 
         if (choice == 1) {
             printf("\nMatrix A:\n");
-            printMatrix(A, r1, c1);
+            printMatrix(&A);
             printf("\nMatrix B:\n");
-            printMatrix(B, r2, c2);
+            printMatrix(&B);
         } else if (choice == 2) {
-            if (!dims_equal(r1, c1, r2, c2)) {
+            if (!dims_equal(A.rows, A.cols, B.rows, B.cols)) {
                 printf("Dimensions must be equal for addition.\n");
             } else {
-                addMatrix(A, B, R, r1, c1);
+                addMatrix(&A, &B, &R);
                 printf("Result (A+B):\n");
-                printMatrix(R, r1, c1);
+                printMatrix(&R);
             }
         } else if (choice == 3) {
-            if (!dims_equal(r1, c1, r2, c2)) {
+            if (!dims_equal(A.rows, A.cols, B.rows, B.cols)) {
                 printf("Dimensions must be equal for subtraction.\n");
             } else {
-                subMatrix(A, B, R, r1, c1);
+                subMatrix(&A, &B, &R);
                 printf("Result (A-B):\n");
-                printMatrix(R, r1, c1);
+                printMatrix(&R);
             }
         } else if (choice == 4) {
-            if (c1 != r2) {
+            if (A.cols != B.rows) {
                 printf("For multiplication A(c1) must equal B(r2).\n");
             } else {
-                multMatrix(A, B, R, r1, c1, c2);
-                printf("Result (A*B):\n");
-                printMatrix(R, r1, c2);
+                if (acc_mode == ACC_INT32) {
+                    multMatrix(&A, &B, &R);
+                    printf("Result (A*B):\n");
+                    printMatrix(&R);
+                    if (int_product_may_overflow(&A, &B))
+                        printf("Warning: int accumulation may overflow; see option 22.\n");
+                } else {
+                    multMatrixAcc(&A, &B, acc_mode, &T);
+                    printf("Result (A*B, %s):\n", acc_mode_names[acc_mode]);
+                    printTMatrix(&T);
+                }
             }
         } else if (choice == 5) {
             int scalar = safe_int_read("Enter scalar: ");
-            scalarMultiply(A, R, r1, c1, scalar);
+            scalarMultiply(&A, &R, scalar);
             printf("Result (scalar * A):\n");
-            printMatrix(R, r1, c1);
+            printMatrix(&R);
         } else if (choice == 6) {
-            transpose(A, R, r1, c1);
-            printf("Transpose of A (size %d x %d):\n", c1, r1);
-            printMatrix(R, c1, r1);
+            transpose(&A, &R);
+            printf("Transpose of A (size %d x %d):\n", R.rows, R.cols);
+            printMatrix(&R);
         } else if (choice == 7) {
-            if (r1 != c1) {
+            if (A.rows != A.cols) {
                 printf("Determinant defined only for square matrices.\n");
             } else {
-                if (r1 > 8) {
-                    printf("Matrix too large for naive det routine (limit = 8).\n");
-                } else {
-                    int det = determinant_recursive(A, r1);
-                    printf("Determinant of A is %d\n", det);
-                }
+                struct Determinant det;
+                double t0 = now_sec();
+                determinant(&A, &det);
+                double t1 = now_sec();
+                printf("Determinant of A is ");
+                printDeterminant(&det);
+                printf("\n(%.3f s)\n", t1 - t0);
             }
         } else if (choice == 8) {
             printf("Which matrix to save? (A/B): ");
@@ -321,8 +3362,8 @@ int main(void) {
             printf("Enter filename: ");
             if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
             int ret;
-            if (ch == 'A' || ch == 'a') ret = saveMatrixToFile(fname, A, r1, c1);
-            else ret = saveMatrixToFile(fname, B, r2, c2);
+            if (ch == 'A' || ch == 'a') ret = saveMatrixText(fname, &A);
+            else ret = saveMatrixText(fname, &B);
             if (ret == 0) printf("Saved successfully.\n");
             else printf("Failed to save.\n");
         } else if (choice == 9) {
@@ -331,49 +3372,181 @@ int main(void) {
             if (scanf(" %c", &ch) != 1) { printf("Read error\n"); continue; }
             printf("Enter filename: ");
             if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
-            int rr, cc;
-            int ret = loadMatrixFromFile(fname, R, &rr, &cc);
+            /* Load into R first so a failed load leaves A/B intact */
+            int ret = loadMatrixText(fname, &R, &mat_pool);
             if (ret != 0) {
                 printf("Failed to load (err=%d)\n", ret);
             } else {
-                if (ch == 'A' || ch == 'a') {
-                    r1 = rr; c1 = cc; copyMatrix(R, A, r1, c1);
-                } else {
-                    r2 = rr; c2 = cc; copyMatrix(R, B, r2, c2);
-                }
+                struct Matrix *dst = (ch == 'A' || ch == 'a') ? &A : &B;
+                struct Matrix tmp = *dst;
+                *dst = R;
+                R = tmp;
                 printf("Loaded successfully into %c\n", ch);
             }
         } else if (choice == 10) {
-            int tempA[MAX][MAX];
-            int tempB[MAX][MAX];
-            int tr = r1, tc = c1;
-            copyMatrix(A, tempA, r1, c1);
-            copyMatrix(B, tempB, r2, c2);
-            copyMatrix(tempA, B, r1, c1); /* B = old A (but sizes differ perhaps) */
-            copyMatrix(tempB, A, r2, c2);
-            /* Swap dims */
-            r1 = r2; c1 = c2;
-            r2 = tr; c2 = tc;
+            struct Matrix tmp = A;
+            A = B;
+            B = tmp;
             printf("Swapped A and B.\n");
         } else if (choice == 11) {
             /* Re-enter matrices entirely */
-            r1 = safe_int_read("Enter rows for matrix A (1..10): ");
-            c1 = safe_int_read("Enter cols for matrix A (1..10): ");
-            if (r1 <= 0 || r1 > MAX || c1 <= 0 || c1 > MAX) { printf("Invalid dims\n"); continue; }
+            if (read_dims("A", &A) != 0) { printf("Invalid dims\n"); continue; }
             printf("Enter Matrix A:\n");
-            readMatrix(A, r1, c1);
-            r2 = safe_int_read("Enter rows for matrix B (1..10): ");
-            c2 = safe_int_read("Enter cols for matrix B (1..10): ");
-            if (r2 <= 0 || r2 > MAX || c2 <= 0 || c2 > MAX) { printf("Invalid dims\n"); continue; }
+            readMatrix(&A);
+            if (read_dims("B", &B) != 0) { printf("Invalid dims\n"); continue; }
             printf("Enter Matrix B:\n");
-            readMatrix(B, r2, c2);
+            readMatrix(&B);
         } else if (choice == 12) {
             printf("Exiting program.\n");
             break;
+        } else if (choice == 13) {
+            if (A.cols != B.rows) {
+                printf("For multiplication A(c1) must equal B(r2).\n");
+            } else {
+                int iters = safe_int_read("Enter iterations: ");
+                if (iters > 0) benchMultiply(&A, &B, iters);
+            }
+        } else if (choice == 14) {
+            int max_n = safe_int_read("Largest size (64..4096): ");
+            if (max_n < 64 || max_n > 4096) max_n = 1024;
+            benchGemm(max_n, 1024);
+        } else if (choice == 15) {
+            int n = safe_int_read("Matrix size n (n x n): ");
+            if (n > 0 && n <= MAX_DIM) benchElementwise(n);
+            else printf("Invalid size.\n");
+        } else if (choice == 16) {
+            int t = safe_int_read("Threads (1..256): ");
+            if (t < 1 || t > 256) {
+                printf("Invalid thread count.\n");
+            } else {
+                pool_destroy(&mat_pool);
+                if (pool_init(&mat_pool, t) != 0)
+                    printf("Could not start %d threads; using 1.\n", t);
+            }
+        } else if (choice == 17) {
+            int n = safe_int_read("Matrix size n (n x n): ");
+            int t = safe_int_read("Max threads: ");
+            if (n > 0 && n <= MAX_DIM && t > 0 && t <= 256) benchScaling(n, t);
+            else printf("Invalid input.\n");
+        } else if (choice == 18) {
+            transposeInPlace(&A);
+            printf("A transposed in place (now %d x %d).\n", A.rows, A.cols);
+        } else if (choice == 19) {
+            int n = safe_int_read("Matrix size n (n x n): ");
+            if (n > 0 && n <= MAX_DIM) benchTranspose(n);
+            else printf("Invalid size.\n");
+        } else if (choice == 20) {
+            printf("Strassen runs on one thread; when on it replaces the threaded multiply\n"
+                   "for square inputs above the crossover.\n");
+            strassen_enabled = safe_int_read("Use Strassen in multiply? (1 = yes, 0 = no): ") != 0;
+            int c = safe_int_read("Crossover size (16..4096): ");
+            if (c >= 16 && c <= 4096) strassen_crossover = c;
+            else printf("Keeping crossover %d.\n", strassen_crossover);
+        } else if (choice == 21) {
+            int max_n = safe_int_read("Largest size (256..4096): ");
+            if (max_n < 256 || max_n > 4096) max_n = 1024;
+            benchStrassen(max_n);
+        } else if (choice == 22) {
+            for (int m = 0; m < ACC_MODES; ++m) printf("  %d. %s\n", m, acc_mode_names[m]);
+            int m = safe_int_read("Mode: ");
+            if (m >= 0 && m < ACC_MODES) acc_mode = (enum AccMode)m;
+            else printf("Invalid mode.\n");
+        } else if (choice == 23) {
+            int n = safe_int_read("Matrix size n (n x n): ");
+            int rng = safe_int_read("Random range (e.g. 2000): ");
+            if (n > 0 && n <= MAX_DIM && rng >= 0) benchAccModes(n, rng);
+            else printf("Invalid input.\n");
+        } else if (choice == 24) {
+            sparse_menu(&A, &B, &R);
+        } else if (choice == 25) {
+            printf("Which matrix to save? (A/B): ");
+            char ch;
+            if (scanf(" %c", &ch) != 1) { printf("Read error\n"); continue; }
+            printf("Enter filename: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
+            if (saveMatrixBinary(fname, (ch == 'A' || ch == 'a') ? &A : &B) == 0)
+                printf("Saved successfully.\n");
+            else
+                printf("Failed to save.\n");
+        } else if (choice == 26) {
+            printf("Load into which matrix? (A/B): ");
+            char ch;
+            if (scanf(" %c", &ch) != 1) { printf("Read error\n"); continue; }
+            printf("Enter filename: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
+            double t0 = now_sec();
+            int ret = loadMatrixBinary(fname, &R, 1);
+            double t1 = now_sec();
+            if (ret != 0) {
+                printf("Failed to load (err=%d)\n", ret);
+            } else {
+                struct Matrix *dst = (ch == 'A' || ch == 'a') ? &A : &B;
+                struct Matrix tmp = *dst;
+                *dst = R;
+                R = tmp;
+                printf("Mapped %d x %d into %c in %.3f ms\n", dst->rows, dst->cols, ch,
+                       (t1 - t0) * 1e3);
+            }
+        } else if (choice == 27) {
+            char out[FNAME_SZ];
+            printf("Enter text file name: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
+            printf("Enter binary file name: ");
+            if (scanf("%127s", out) != 1) { printf("Read error\n"); continue; }
+            double t0 = now_sec();
+            int ret = convertTextToBinary(fname, out);
+            double t1 = now_sec();
+            if (ret != 0) {
+                printf("Conversion failed (err=%d)\n", ret);
+            } else {
+                struct Matrix m;
+                matrix_init(&m);
+                double t2 = now_sec();
+                ret = loadMatrixBinary(out, &m, 1);
+                double t3 = now_sec();
+                printf("Converted in %.3f s; binary load %.3f ms%s\n", t1 - t0,
+                       (t3 - t2) * 1e3, ret == 0 ? "" : " (failed)");
+                matrix_free(&m);
+            }
+        } else if (choice == 28) {
+            int n = safe_int_read("Matrix size n (n x n): ");
+            printf("Enter scratch file name: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
+            if (n > 0 && n <= MAX_DIM) benchTextIO(n, fname);
+            else printf("Invalid size.\n");
+        } else if (choice == 29) {
+            int rows = safe_int_read("Rows: ");
+            int cols = safe_int_read("Cols: ");
+            int rng = safe_int_read("Random range (positive integer): ");
+            printf("Enter file name: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
+            if (rows <= 0 || cols <= 0 || rng < 0) {
+                printf("Invalid input.\n");
+            } else {
+                int ret = createRandomBinary(fname, rows, cols, rng);
+                if (ret == 0) printf("Created %d x %d in %s\n", rows, cols, fname);
+                else printf("Failed (err=%d)\n", ret);
+            }
+        } else if (choice == 30) {
+            char fb[FNAME_SZ], fc[FNAME_SZ];
+            printf("Enter binary file for A: ");
+            if (scanf("%127s", fname) != 1) { printf("Read error\n"); continue; }
+            printf("Enter binary file for B: ");
+            if (scanf("%127s", fb) != 1) { printf("Read error\n"); continue; }
+            printf("Enter output file for C: ");
+            if (scanf("%127s", fc) != 1) { printf("Read error\n"); continue; }
+            int mib = safe_int_read("Memory budget in MiB (e.g. 64): ");
+            int ret = mib > 0 ? multiplyOutOfCore(fname, fb, fc, (size_t)mib << 20, 1) : -6;
+            if (ret != 0) printf("Out-of-core multiply failed (err=%d)\n", ret);
         } else {
             printf("Invalid option. Try again.\n");
         }
     }
 
+    matrix_free(&A);
+    matrix_free(&B);
+    matrix_free(&R);
+    tmatrix_free(&T);
+    pool_destroy(&mat_pool);
     return 0;
 }
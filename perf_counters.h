@@ -0,0 +1,200 @@
+/* perf_counters.h
+ *
+ * Optional hardware performance counters for the benchmark harnesses.
+ * Wraps Linux perf_event_open: cycles, instructions, LLC misses, branch
+ * misses and dTLB load misses, measured in user space around one kernel.
+ * The events are opened as one group per thread and summed; threads
+ * started during a measurement are counted through inherit.
+ *
+ * Counting is off unless the environment sets PERF_COUNTERS=1. Events the
+ * CPU/kernel/container does not allow are skipped; on other platforms
+ * everything compiles to no-ops.
+ *
+ * The including file must define _GNU_SOURCE before any system header.
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum {
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_BRANCH_MISSES,
+    PC_DTLB_MISSES,
+    PC_COUNT
+};
+
+/* Group 0 counts the thread that called perf_open plus every thread it
+   creates afterwards (inherit). Threads that already existed, such as a
+   persistent worker pool, join with perf_add_thread into groups 1.. */
+#define PC_MAX_GROUPS 64
+
+static const char *const perf_counter_names[PC_COUNT] = {
+    "cycles", "instructions", "llc-misses", "branch-misses", "dtlb-misses"
+};
+
+struct PerfCounters {
+    int fd[PC_MAX_GROUPS][PC_COUNT];
+    unsigned long long value[PC_COUNT]; /* summed over groups, scaled */
+    int enabled;     /* at least one event opened */
+    int multiplexed; /* some event was only scheduled part of the time */
+};
+
+#ifdef __linux__
+/* Each event is read as { value, time_enabled, time_running } */
+struct PerfRead {
+    unsigned long long value;
+    unsigned long long enabled;
+    unsigned long long running;
+};
+
+static int perf_open_event(unsigned type, unsigned long long config, int tid, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0; /* members follow their leader */
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0);
+}
+
+/* Open all events for thread tid (0 = caller) as one group, so they are
+   scheduled onto the PMU together and their ratios are consistent. The
+   first event that opens leads; the rest join it. */
+static void perf_open_group(int *fd, int tid) {
+    static const unsigned type[PC_COUNT] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+    };
+    static const unsigned long long config[PC_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    int leader = -1;
+    for (int i = 0; i < PC_COUNT; ++i) {
+        fd[i] = perf_open_event(type[i], config[i], tid, leader);
+        if (leader < 0) leader = fd[i];
+    }
+}
+
+static int perf_leader(const int *fd) {
+    for (int i = 0; i < PC_COUNT; ++i)
+        if (fd[i] >= 0) return fd[i];
+    return -1;
+}
+#endif
+
+/* Open the counters if PERF_COUNTERS=1; pc->enabled tells whether any did */
+static void perf_open(struct PerfCounters *pc) {
+    memset(pc, 0, sizeof(*pc));
+    for (int g = 0; g < PC_MAX_GROUPS; ++g)
+        for (int i = 0; i < PC_COUNT; ++i) pc->fd[g][i] = -1;
+    const char *env = getenv("PERF_COUNTERS");
+    if (!env || strcmp(env, "1") != 0) return;
+#ifdef __linux__
+    perf_open_group(pc->fd[0], 0);
+    pc->enabled = perf_leader(pc->fd[0]) >= 0;
+    if (!pc->enabled)
+        fprintf(stderr, "perf counters unavailable (check perf_event_paranoid)\n");
+#endif
+}
+
+/* Also count the calling thread, in group slot (1 .. PC_MAX_GROUPS-1).
+   Call from each thread that existed before perf_open; distinct slots
+   may be added concurrently. Only the events group 0 has are opened. */
+static inline void perf_add_thread(struct PerfCounters *pc, int slot) {
+#ifdef __linux__
+    if (!pc->enabled || slot <= 0 || slot >= PC_MAX_GROUPS) return;
+    perf_open_group(pc->fd[slot], 0);
+    for (int i = 0; i < PC_COUNT; ++i) {
+        if (pc->fd[0][i] < 0 && pc->fd[slot][i] >= 0) {
+            close(pc->fd[slot][i]);
+            pc->fd[slot][i] = -1;
+        }
+    }
+#else
+    (void)pc;
+    (void)slot;
+#endif
+}
+
+static void perf_close(struct PerfCounters *pc) {
+#ifdef __linux__
+    for (int g = 0; g < PC_MAX_GROUPS; ++g)
+        for (int i = 0; i < PC_COUNT; ++i)
+            if (pc->fd[g][i] >= 0) close(pc->fd[g][i]);
+#endif
+    pc->enabled = 0;
+}
+
+static void perf_start(struct PerfCounters *pc) {
+#ifdef __linux__
+    for (int g = 0; g < PC_MAX_GROUPS; ++g) {
+        int leader = perf_leader(pc->fd[g]);
+        if (leader < 0) continue;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)pc;
+#endif
+}
+
+/* Stop all groups and sum them. A count that was multiplexed with other
+   users of the PMU is scaled up by time_enabled / time_running. */
+static void perf_stop(struct PerfCounters *pc) {
+#ifdef __linux__
+    for (int g = 0; g < PC_MAX_GROUPS; ++g) {
+        int leader = perf_leader(pc->fd[g]);
+        if (leader >= 0) ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+    pc->multiplexed = 0;
+    for (int i = 0; i < PC_COUNT; ++i) {
+        pc->value[i] = 0;
+        for (int g = 0; g < PC_MAX_GROUPS; ++g) {
+            struct PerfRead r;
+            if (pc->fd[g][i] < 0) continue;
+            if (read(pc->fd[g][i], &r, sizeof(r)) != sizeof(r) || r.running == 0) continue;
+            if (r.running < r.enabled) {
+                pc->multiplexed = 1;
+                r.value = (unsigned long long)((double)r.value * r.enabled / r.running);
+            }
+            pc->value[i] += r.value;
+        }
+    }
+#else
+    (void)pc;
+#endif
+}
+
+/* Print the last start/stop interval divided by ops, one line per label */
+static void perf_report(const struct PerfCounters *pc, const char *label, double ops) {
+    if (!pc->enabled || ops <= 0) return;
+    printf("  %-18s", label);
+    for (int i = 0; i < PC_COUNT; ++i) {
+        if (pc->fd[0][i] < 0) printf(" %s=n/a", perf_counter_names[i]);
+        else printf(" %s=%.2f", perf_counter_names[i], pc->value[i] / ops);
+    }
+    if (pc->fd[0][PC_CYCLES] >= 0 && pc->fd[0][PC_INSTRUCTIONS] >= 0 && pc->value[PC_CYCLES])
+        printf(" ipc=%.2f", (double)pc->value[PC_INSTRUCTIONS] / pc->value[PC_CYCLES]);
+    printf("  (per op%s)\n", pc->multiplexed ? ", scaled for multiplexing" : "");
+}
+
+#endif /* PERF_COUNTERS_H */